@@ -86,26 +86,29 @@ int main() {
     }
   }
   int gs = groups.size();
-  vector<vector<bool>> mat;
+  sparse_matrix mat(gs + is);
   vector<Row> rows;
   for (unsigned short g = 0; g < gs; g++) {
     iter_partitions(groups[g].size, [&](Partition &p) {
       if (valid_tile(board, groups[g], w, h, p)) {
-        vector<bool> row(gs + is, false);
-        row[g] = true;
+        vector<int> option = {g};
         iter_tile(board, groups[g], w, h, p, [&](int j, int i, int d)  {
           // Check if index[j][i] is valid before accessing, this lambda does not use d
           if (valid(j, i, w, h) && index[j][i] != -1) {
-             row[gs + index[j][i]] = true;
+             option.push_back(gs + index[j][i]);
           }
         });
-        mat.push_back(row);
+        mat.add_option(option);
         rows.push_back(Row{g, p});
       }
     });
   }
   // Solve and print.
-  cout << "rows: " << mat.size() << "\n";
+  cout << "rows: " << mat.options() << "\n";
+  // Most rows clash with the only rows left for some group or cell.
+  reduction pre = preprocess(mat);
+  cout << "removed: " << pre.removed.size()
+       << ", forced: " << pre.forced.size() << "\n";
 
   exactcover(mat, [&](const vector<int>& solution_rows) {
     // Define special IDs for lines and empty cells
@@ -90,7 +90,7 @@ int main(void) {
 
   // print the solution.
   print_solution out(grid, given);
-  exactcover(mat, out);
+  static_exactcover<216, 144>(mat, out);
 
   return 0;
 }
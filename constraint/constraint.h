@@ -6,6 +6,7 @@
 #include <cstdio>
 #include <limits>
 #include <queue>
+#include <algorithm>
 
 struct VariableId {
   int id;
@@ -26,22 +27,138 @@ struct Bounds {
   int lmin, lmax;
 };
 
+// Sums of the bounds of the variables of a constraint, and the widest
+// domain any of them started with, which no domain can grow past.
+struct ConstraintSums {
+  int lmin, lmax, width;
+};
+
 struct Metadata {
   VariableId id;
   std::vector<int> constraints;
 };
 
+// What a change did to a variable. Constraints are only woken by the
+// events they care about.
+enum VariableEvent {
+  MIN_CHANGED = 1,
+  MAX_CHANGED = 2,
+  FIXED = 4,
+  ANY_CHANGE = MIN_CHANGED | MAX_CHANGED | FIXED
+};
+
+// A change to the bounds of a variable, with the bounds it had before.
+struct TrailEntry {
+  VariableId id;
+  Bounds old;
+};
+
 class State {
   std::vector<Bounds> bounds, solution;
   std::vector<Metadata> metadata;
+  // Every change since the start, so that backtracking only undoes what
+  // was changed below a mark.
+  std::vector<TrailEntry> trail;
+  // Binary heap of the variables not fixed yet, smallest domain first,
+  // then most constraints, then lowest id, and the position of each
+  // variable in it, or -1. The keys are kept in the heap so that sifting
+  // doesn't have to look them up. Fixed variables are only taken out
+  // when they reach the top, as most are unfixed again by backtracking
+  // before that.
+  struct HeapEntry {
+    int width, degree, id;
+    bool operator<(const HeapEntry& other) const {
+      if (width != other.width) {
+        return width < other.width;
+      }
+      if (degree != other.degree) {
+        return degree > other.degree;
+      }
+      return id < other.id;
+    }
+  };
+  std::vector<HeapEntry> heap;
+  std::vector<int> position;
+  int unfixed = 0;
+  // Kept up to date by change_var and undo, see sums.
+  std::vector<ConstraintSums> constraint_sums;
+
+  void add_to_sums(int id, int dmin, int dmax) {
+    for (int cons : metadata[id].constraints) {
+      constraint_sums[cons].lmin += dmin;
+      constraint_sums[cons].lmax += dmax;
+    }
+  }
+
+  void place(int pos, const HeapEntry& entry) {
+    heap[pos] = entry;
+    position[entry.id] = pos;
+  }
+
+  void sift_up(int pos) {
+    HeapEntry entry = heap[pos];
+    while (pos > 0 && entry < heap[(pos - 1) / 2]) {
+      place(pos, heap[(pos - 1) / 2]);
+      pos = (pos - 1) / 2;
+    }
+    place(pos, entry);
+  }
+
+  void sift_down(int pos) {
+    HeapEntry entry = heap[pos];
+    int size = heap.size();
+    while (2 * pos + 1 < size) {
+      int child = 2 * pos + 1;
+      if (child + 1 < size && heap[child + 1] < heap[child]) {
+        child++;
+      }
+      if (!(heap[child] < entry)) {
+        break;
+      }
+      place(pos, heap[child]);
+      pos = child;
+    }
+    place(pos, entry);
+  }
+
+  // Moves a variable in the heap after its bounds changed from a domain
+  // of the given width.
+  void update(int id, int old_width) {
+    int pos = position[id];
+    int width = bounds[id].lmax - bounds[id].lmin;
+    unfixed += (width > 0) - (old_width > 0);
+    if (width == 0) {
+      return;
+    } else if (pos < 0) {
+      int degree = metadata[id].constraints.size();
+      heap.push_back(HeapEntry{width, degree, id});
+      sift_up(heap.size() - 1);
+    } else if (heap[pos].width != width) {
+      heap[pos].width = width;
+      sift_up(pos);
+      sift_down(position[id]);
+    }
+  }
+
  public:
-  State(const std::vector<Variable>& variables) 
-      : bounds(variables.size()), metadata(variables.size()) {
+  State(const std::vector<Variable>& variables, int constraints)
+      : bounds(variables.size()), metadata(variables.size()),
+        position(variables.size(), -1),
+        constraint_sums(constraints, ConstraintSums{0, 0, 0}) {
     for (const Variable& var : variables) {
       bounds[var.id].lmin = var.lmin;
       bounds[var.id].lmax = var.lmax;
       metadata[var.id].id = var.id;
       metadata[var.id].constraints = var.constraints;
+      for (int cons : var.constraints) {
+        ConstraintSums& sums = constraint_sums[cons];
+        sums.lmin += var.lmin;
+        sums.lmax += var.lmax;
+        sums.width = std::max(sums.width, var.lmax - var.lmin);
+      }
+    }
+    for (const Variable& var : variables) {
+      update(var.id, 0);
     }
   }
 
@@ -65,17 +182,67 @@ class State {
     return solution[id].lmin;
   }
 
-  void change_var(VariableId var_id, int lmin, int lmax) {
+  // Returns the VariableEvents of the change.
+  int change_var(VariableId var_id, int lmin, int lmax) {
+    const Bounds& old = bounds[var_id];
+    trail.push_back(TrailEntry{var_id, old});
+    int old_width = old.lmax - old.lmin;
+    int events = (lmin > old.lmin ? MIN_CHANGED : 0) |
+                 (lmax < old.lmax ? MAX_CHANGED : 0) |
+                 (lmin == lmax && old_width > 0 ? FIXED : 0);
+    add_to_sums(var_id, lmin - old.lmin, lmax - old.lmax);
     bounds[var_id].lmin = lmin;
     bounds[var_id].lmax = lmax;
+    update(var_id, old_width);
+    return events;
+  }
+
+  // The sums of the bounds of the variables of a constraint, given by
+  // its index in the solver.
+  const ConstraintSums& sums(int cons) const {
+    return constraint_sums[cons];
+  }
+
+  int free_variables() const {
+    return unfixed;
+  }
+
+  // The free variable with the smallest domain, breaking ties by the
+  // number of constraints and then by id, or 0 if there is none.
+  VariableId most_constrained() {
+    while (!heap.empty() && fixed(heap[0].id)) {
+      position[heap[0].id] = -1;
+      HeapEntry last = heap.back();
+      heap.pop_back();
+      if (!heap.empty()) {
+        place(0, last);
+        sift_down(0);
+      }
+    }
+    return heap.empty() ? 0 : heap[0].id;
   }
 
   const std::vector<Bounds>& get_variables() {
     return bounds;
   }
 
-  void set_variables(const std::vector<Bounds>& new_vars) {
-    bounds = new_vars;
+  // Position in the trail, to undo back to later.
+  size_t mark() const {
+    return trail.size();
+  }
+
+  // Restores the bounds as they were at the mark.
+  void undo(size_t mark) {
+    while (trail.size() > mark) {
+      const TrailEntry& entry = trail.back();
+      Bounds& current = bounds[entry.id];
+      int old_width = current.lmax - current.lmin;
+      add_to_sums(entry.id, entry.old.lmin - current.lmin,
+                  entry.old.lmax - current.lmax);
+      current = entry.old;
+      update(entry.id, old_width);
+      trail.pop_back();
+    }
   }
 };
 
@@ -88,29 +255,58 @@ class ConstraintQueue;
 
 class TightenConstraint {
  public:
+  // Index in the solver, set by add_constraint.
+  int id = -1;
+
   virtual bool update_constraint(
       State *state, ConstraintQueue* cqueue) const = 0;
   virtual const std::vector<VariableId>& get_variables() const = 0;
+
+  // The VariableEvents on its variables that can let the constraint
+  // tighten further.
+  virtual int events() const {
+    return ANY_CHANGE;
+  }
+
+  // Whether update_constraint runs to its own fixpoint, so the changes
+  // it makes don't need to wake it again.
+  virtual bool idempotent() const {
+    return false;
+  }
+
+  // Times update_constraint had to scan all its variables, for the
+  // statistics.
+  virtual long long full_scans() const {
+    return 0;
+  }
 };
 
 class ConstraintQueue {
   const std::vector<Variable>& variables;
   const std::vector<const TightenConstraint*>& constraints;
   std::queue<int> active_constraints;
-  std::vector<bool> queued_constraints;
+  std::vector<bool> queued_constraints, idempotent;
+  std::vector<int> events;
+  // The constraint being updated, or -1.
+  int running;
  public:
   ConstraintQueue(const std::vector<Variable>& variables_,
       const std::vector<const TightenConstraint*>& constraints_)
-      : variables(variables_), constraints(constraints_) {
+      : variables(variables_), constraints(constraints_), running(-1) {
     queued_constraints.resize(constraints.size(), true);
     for (int i = 0; i < int(constraints.size()); i++) {
       active_constraints.push(i);
+      idempotent.push_back(constraints[i]->idempotent());
+      events.push_back(constraints[i]->events());
     }
   }
 
-  void push_variable(VariableId index) {
+  // Wakes the constraints of the variable that care about the events,
+  // except the one that made the change if it's idempotent.
+  void push_variable(VariableId index, int changes = ANY_CHANGE) {
     for (int cons : variables[index].constraints) {
-      if (!queued_constraints[cons]) {
+      if (!queued_constraints[cons] && (events[cons] & changes) &&
+          !(cons == running && idempotent[cons])) {
         active_constraints.push(cons);
         queued_constraints[cons] = true;
       }
@@ -121,9 +317,14 @@ class ConstraintQueue {
     int cons = active_constraints.front();
     active_constraints.pop();
     queued_constraints[cons] = false;
+    running = cons;
     return cons;
   }
 
+  void done() {
+    running = -1;
+  }
+
   bool empty() {
     return active_constraints.empty();
   }
@@ -140,6 +341,9 @@ class ConstraintQueue {
 class LinearConstraint : public TightenConstraint {
   int lmin, lmax;
   std::vector<VariableId> variables;
+  // Times the sums alone were not enough and the variables had to be
+  // scanned.
+  mutable long long scans = 0;
  public:
   LinearConstraint(int lmin_, int lmax_) : lmin(lmin_), lmax(lmax_) {}
   virtual ~LinearConstraint() {}
@@ -152,35 +356,44 @@ class LinearConstraint : public TightenConstraint {
     return variables;
   }
 
+  virtual bool idempotent() const {
+    return true;
+  }
+
+  virtual long long full_scans() const {
+    return scans;
+  }
+
+  // Tightens the variables until none changes. The sums of their bounds
+  // are kept by the state, so the variables are only scanned when some
+  // domain is wider than the slack left to lmin or lmax.
   virtual bool update_constraint(State *state, ConstraintQueue* cqueue) const {
-    int allmax = 0, allmin = 0;
-    for (const VariableId& ivar : variables) {
-      allmax += state->read_lmax(ivar);
-      allmin += state->read_lmin(ivar);
-    }
-    if (allmax < lmin || allmin > lmax) {
+    const ConstraintSums& sums = state->sums(id);
+    if (sums.lmax < lmin || sums.lmin > lmax) {
       return false;
     }
-    for (const VariableId& ivar : variables) {
-      // increase min
-      int limit = lmin - allmax + state->read_lmax(ivar);
-      if (limit > state->read_lmax(ivar)) {
-        return false;
-      }
-      if (state->read_lmin(ivar) < limit) {
-        state->change_var(ivar, limit, state->read_lmax(ivar));
-        cqueue->push_variable(ivar);
-        return true;
-      }
-      // decrease max
-      limit = lmax - allmin + state->read_lmin(ivar);
-      if (limit < state->read_lmin(ivar)) {
+    if (sums.width <= sums.lmax - lmin && sums.width <= lmax - sums.lmin) {
+      return true;
+    }
+    scans++;
+    bool changed = true;
+    while (changed) {
+      if (sums.lmax < lmin || sums.lmin > lmax) {
         return false;
       }
-      if (state->read_lmax(ivar) > limit) {
-        state->change_var(ivar, state->read_lmin(ivar), limit);
-        cqueue->push_variable(ivar);
-        return true;
+      changed = false;
+      for (const VariableId& ivar : variables) {
+        int vmin = state->read_lmin(ivar), vmax = state->read_lmax(ivar);
+        // increase min and decrease max
+        int newmin = std::max(vmin, lmin - sums.lmax + vmax);
+        int newmax = std::min(vmax, lmax - sums.lmin + vmin);
+        if (newmin > newmax) {
+          return false;
+        }
+        if (newmin != vmin || newmax != vmax) {
+          cqueue->push_variable(ivar, state->change_var(ivar, newmin, newmax));
+          changed = true;
+        }
       }
     }
     return true;
@@ -221,8 +434,9 @@ class ConstraintSolver {
     return state->value(id);
   }
 
-  void add_constraint(const TightenConstraint* cons) {
+  void add_constraint(TightenConstraint* cons) {
     int id = tighten.size();
+    cons->id = id;
     tighten.push_back(cons);
     for (const VariableId& var : cons->get_variables()) {
       variables[var].constraints.push_back(id);
@@ -230,22 +444,23 @@ class ConstraintSolver {
   }
 
   bool solve() {
-    state = new State(variables);
+    state = new State(variables, tighten.size());
     if (!silent) std::cout << "Variables: " << variables.size() << "\n";
     if (!silent) std::cout << "Constraints: " << tighten.size() << "\n";
     cqueue = new ConstraintQueue(variables, tighten);
     tight();
-    int freevars = 0;
-    for (const auto& var : variables) {
-      if (!state->fixed(var.id)) {
-        freevars++;
-      }
+    if (!silent) {
+      std::cout << "Free variables: " << state->free_variables() << "\n";
     }
-    if (!silent) std::cout << "Free variables: " << freevars << "\n";
     bool result = recursion();
     if (!silent) {
       std::cout << "Recursion nodes: " << recursion_nodes << "\n";
       std::cout << "Constraints checked: " << constraints_checked << "\n";
+      long long scans = 0;
+      for (const TightenConstraint* cons : tighten) {
+        scans += cons->full_scans();
+      }
+      std::cout << "Full scans: " << scans << "\n";
       std::cout << "Solution " << (result ? "" : "not ") << "found\n";
     }
     return result;
@@ -258,26 +473,22 @@ class ConstraintSolver {
       return true;
     }
     VariableId index = choose();
-    std::vector<Bounds> bkp = state->get_variables();
+    size_t mark = state->mark();
     int savemin = state->read_lmin(index), savemax = state->read_lmax(index);
     for (int i = savemin; i <= savemax; i++) {
-      state->set_variables(bkp);
-      state->change_var(index, i, i);
-      cqueue->push_variable(index);
+      state->undo(mark);
+      cqueue->push_variable(index, state->change_var(index, i, i));
       if (tight() && valid()) {
-        int x = 0;
-        for (const Variable& var : variables) {
-          if (state->fixed(var.id)) {
-            x++;
-          }
+        if (!silent) {
+          int x = variables.size() - state->free_variables();
+          std::cout << "x " << x << "\n";
         }
-        if (!silent) std::cout << "x " << x << "\n";
         if (recursion()) {
           return true;
         }
       }
     }
-    state->set_variables(bkp);
+    state->undo(mark);
     return false;
   }
 
@@ -291,37 +502,20 @@ class ConstraintSolver {
   }
 
   VariableId choose() {
-    VariableId chosen = 0;
-    int diff = std::numeric_limits<int>::max();
-    for (const Variable& var : variables) {
-      if (!state->fixed(var.id)) {
-        int cur_diff = state->read_lmax(var.id) - state->read_lmin(var.id);
-        if (cur_diff < diff) {
-          chosen = var.id;
-          diff = cur_diff;
-        } else if (cur_diff == diff && 
-            var.constraints.size() > variables[chosen].constraints.size()) {
-          chosen = var.id;
-        }
-      }
-    }
-    return chosen;
+    return state->most_constrained();
   }
 
   bool finished() {
-    for (const Variable& var : variables) {
-      if (!state->fixed(var.id)) {
-        return false;
-      }
-    }
-    return true;
+    return state->free_variables() == 0;
   }
 
   bool tight() {
     while (!cqueue->empty()) {
       int id = cqueue->pop_constraint();
       constraints_checked++;
-      if (!tighten[id]->update_constraint(state, cqueue)) {
+      bool feasible = tighten[id]->update_constraint(state, cqueue);
+      cqueue->done();
+      if (!feasible) {
         cqueue->clear();
         return false;
       }
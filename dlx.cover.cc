@@ -0,0 +1,65 @@
+// Solver for exact cover problems in Knuth's .dlx format
+// Usage: dlx.cover file.dlx [max_solutions | count]
+// With count, the solutions are counted with a ZDD instead of listed.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+#include "exactcover/exactcover.h"
+#include "exactcover/dlxfile.h"
+
+// callback to print the solutions found.
+struct print_solution {
+  const dlx_file& file;
+  int count;
+
+  explicit print_solution(const dlx_file& file_): file(file_), count(0) {}
+
+  void operator()(const vector<int>& solution) {
+    cout << ++count << ":\n";
+    for (int option : solution) {
+      cout << " " << file.option(option) << "\n";
+    }
+  }
+};
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    cerr << "usage: " << argv[0] << " file.dlx [max_solutions | count]\n";
+    return 1;
+  }
+  dlx_file file;
+  if (!file.open(argv[1])) {
+    cerr << argv[1] << ": " << file.error << "\n";
+    return 1;
+  }
+  const sparse_matrix& mat = file.matrix;
+  cerr << mat.primary() << " primary items, " << mat.secondary
+       << " secondary items, " << mat.options() << " options\n";
+  if (argc > 2 && strcmp(argv[2], "count") == 0) {
+    if (!mat.lo.empty() || !mat.colors.empty()) {
+      cerr << "count needs a problem without colors or multiplicities\n";
+      return 1;
+    }
+    solution_zdd zdd = build_zdd(mat);
+    cerr << zdd.nodes.size() << " ZDD nodes\n";
+    cout << zdd.count() << " solutions\n";
+    return 0;
+  }
+  int max_solutions = argc > 2 ? atoi(argv[2]) : 0;
+  print_solution print(file);
+  if (!mat.lo.empty()) {
+    multicover(mat, ref(print), max_solutions);
+  } else if (!mat.colors.empty()) {
+    colorcover(mat, ref(print), max_solutions);
+  } else {
+    exactcover(mat, ref(print), max_solutions);
+  }
+  cerr << print.count << " solutions\n";
+  return 0;
+}
@@ -80,7 +80,7 @@ int main(void) {
         mmap[49+j*8+i][28+(j+1)*8+i] = true;
       }
     print_solution print;
-    exactcover(mmap, print);
+    static_exactcover<97, 84>(mmap, print);
   }
   return 0;
 }
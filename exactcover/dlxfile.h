@@ -0,0 +1,321 @@
+#ifndef EXACTCOVER_DLXFILE_H
+#define EXACTCOVER_DLXFILE_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "exactcover.h"
+
+// Open addressing hash table from names to their index. Much faster
+// than std::unordered_map for the millions of lookups of a big file.
+struct name_table {
+  std::vector<std::string_view> keys;
+  std::vector<int> values;
+  size_t mask, size;
+
+  name_table(): keys(16), values(16, -1), mask(15), size(0) {}
+
+  static size_t hash(std::string_view name) {
+    uint64_t h = 14695981039346656037ull;
+    for (char c : name) {
+      h = (h ^ uint8_t(c)) * 1099511628211ull;
+    }
+    return h ^ (h >> 29);
+  }
+
+  size_t slot(std::string_view name) const {
+    size_t i = hash(name) & mask;
+    while (values[i] >= 0 && keys[i] != name) {
+      i = (i + 1) & mask;
+    }
+    return i;
+  }
+
+  // Returns the index of name, or -1 if it's not there.
+  int find(std::string_view name) const {
+    return values[slot(name)];
+  }
+
+  // Adds name with the given index unless it's already there, and
+  // returns the index it has.
+  int insert(std::string_view name, int value) {
+    size_t i = slot(name);
+    if (values[i] >= 0) {
+      return values[i];
+    }
+    keys[i] = name;
+    values[i] = value;
+    if (++size * 2 > keys.size()) {
+      grow();
+    }
+    return value;
+  }
+
+  // Doubles the table, keeping it at most half full.
+  void grow() {
+    std::vector<std::string_view> old_keys(keys.size() * 2);
+    std::vector<int> old_values(values.size() * 2, -1);
+    old_keys.swap(keys);
+    old_values.swap(values);
+    mask = keys.size() - 1;
+    for (size_t i = 0; i < old_keys.size(); i++) {
+      if (old_values[i] >= 0) {
+        size_t j = slot(old_keys[i]);
+        keys[j] = old_keys[i];
+        values[j] = old_values[i];
+      }
+    }
+  }
+};
+
+// A .dlx file read into a sparse_matrix, as used by dlx1, dlx2 and dlx3.
+// The first line lists the primary items, then a lone | and the
+// secondary items. A primary item may be prefixed by u:v| or v| to be
+// covered between u and v times. Each following line is an option, and
+// secondary items in it may carry a color as name:color. Lines starting
+// with | are comments.
+//
+// The file is memory-mapped and read in a single pass. Item names and
+// option lines are views into the mapping, which lives as long as the
+// dlx_file, so nothing is copied.
+struct dlx_file {
+  sparse_matrix matrix;
+  std::vector<std::string_view> item_names, color_names, option_lines;
+  // Why open failed, with the line number if it's a syntax error.
+  std::string error;
+  const char* data;
+  size_t length;
+
+  dlx_file(): matrix(0), data(nullptr), length(0) {}
+  dlx_file(const dlx_file&) = delete;
+  dlx_file& operator=(const dlx_file&) = delete;
+
+  ~dlx_file() {
+    if (data != nullptr) {
+      munmap(const_cast<char*>(data), length);
+    }
+  }
+
+  bool open(const char* filename) {
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+      error = std::string("can't open ") + filename;
+      return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0 || info.st_size == 0) {
+      close(fd);
+      error = std::string("can't read ") + filename;
+      return false;
+    }
+    length = info.st_size;
+    void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+      error = std::string("can't map ") + filename;
+      return false;
+    }
+    data = static_cast<const char*>(mapped);
+    madvise(mapped, length, MADV_SEQUENTIAL);
+    return parse();
+  }
+
+  // The option as written in the file.
+  std::string_view option(int i) const {
+    return option_lines[i];
+  }
+
+  bool fail(int line, const std::string& message) {
+    error = "line " + std::to_string(line) + ": " + message;
+    return false;
+  }
+
+  static bool blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+  }
+
+  // Splits [begin, end) into words separated by blanks.
+  template<typename F>
+  static void words(const char* begin, const char* end, F func) {
+    const char* p = begin;
+    while (true) {
+      while (p < end && blank(*p)) {
+        p++;
+      }
+      if (p == end) {
+        return;
+      }
+      const char* start = p;
+      while (p < end && !blank(*p)) {
+        p++;
+      }
+      func(std::string_view(start, p - start));
+    }
+  }
+
+  static bool number(std::string_view text, int& value) {
+    if (text.empty()) {
+      return false;
+    }
+    value = 0;
+    for (char c : text) {
+      if (c < '0' || c > '9') {
+        return false;
+      }
+      value = value * 10 + (c - '0');
+    }
+    return true;
+  }
+
+  bool parse() {
+    name_table items, colors;
+    std::vector<int> option, option_colors;
+    std::vector<std::pair<int, int>> bounds;
+    // Line that last named each item, to catch an item named twice.
+    std::vector<int> seen;
+    bool header = true, ok = true;
+    int line = 0;
+    const char* end = data + length;
+    for (const char* p = data; p < end && ok;) {
+      const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+      if (eol == nullptr) {
+        eol = end;
+      }
+      const char* start = p;
+      p = eol + 1;
+      line++;
+      while (start < eol && blank(*start)) {
+        start++;
+      }
+      if (start == eol || *start == '|') {
+        continue;
+      }
+      if (header) {
+        ok = parse_items(start, eol, line, items, bounds);
+        seen.assign(item_names.size(), 0);
+        header = false;
+        continue;
+      }
+      option.clear();
+      option_colors.clear();
+      bool colored = false;
+      words(start, eol, [&](std::string_view word) {
+        if (!ok) {
+          return;
+        }
+        std::string_view name = word.substr(0, word.find(':'));
+        int item = items.find(name);
+        if (item < 0) {
+          ok = fail(line, "unknown item " + std::string(name));
+          return;
+        }
+        if (seen[item] == line) {
+          ok = fail(line, "duplicate item " + std::string(name));
+          return;
+        }
+        seen[item] = line;
+        int color = 0;
+        if (name.size() < word.size()) {
+          if (item < matrix.primary()) {
+            ok = fail(line, "color on primary item " + std::string(name));
+            return;
+          }
+          std::string_view color_name = word.substr(name.size() + 1);
+          color = colors.insert(color_name, color_names.size() + 1);
+          if (color > int(color_names.size())) {
+            color_names.push_back(color_name);
+          }
+          colored = true;
+        }
+        option.push_back(item);
+        option_colors.push_back(color);
+      });
+      if (!ok) {
+        break;
+      }
+      bool added = colored ? matrix.add_option(option, option_colors)
+                           : matrix.add_option(option);
+      if (!added) {
+        ok = fail(line, "bad option");
+        break;
+      }
+      option_lines.emplace_back(start, eol - start);
+    }
+    if (ok && header) {
+      return fail(line, "no items");
+    }
+    return ok;
+  }
+
+  bool parse_items(const char* begin, const char* end, int line,
+                   name_table& items,
+                   std::vector<std::pair<int, int>>& bounds) {
+    int primary = -1;
+    bool ok = true, multiple = false;
+    words(begin, end, [&](std::string_view word) {
+      if (!ok) {
+        return;
+      }
+      if (word == "|") {
+        if (primary >= 0) {
+          ok = fail(line, "more than one |");
+        }
+        primary = item_names.size();
+        return;
+      }
+      int lo = 1, hi = 1;
+      size_t bar = word.rfind('|');
+      if (bar != std::string_view::npos) {
+        if (primary >= 0) {
+          ok = fail(line, "multiplicity on secondary item");
+          return;
+        }
+        std::string_view range = word.substr(0, bar);
+        size_t colon = range.find(':');
+        bool valid = colon == std::string_view::npos ?
+            number(range, hi) :
+            number(range.substr(0, colon), lo) &&
+            number(range.substr(colon + 1), hi);
+        if (colon == std::string_view::npos) {
+          lo = hi;
+        }
+        if (!valid || hi < 1 || lo > hi) {
+          ok = fail(line, "bad multiplicity " + std::string(word));
+          return;
+        }
+        word = word.substr(bar + 1);
+        multiple = true;
+      }
+      int index = item_names.size();
+      if (word.empty() || word.find(':') != std::string_view::npos ||
+          items.insert(word, index) != index) {
+        ok = fail(line, "bad item name " + std::string(word));
+        return;
+      }
+      item_names.push_back(word);
+      bounds.emplace_back(lo, hi);
+    });
+    if (!ok) {
+      return false;
+    }
+    if (primary < 0) {
+      primary = item_names.size();
+    }
+    matrix = sparse_matrix(primary, item_names.size() - primary);
+    if (multiple) {
+      for (int i = 0; i < primary; i++) {
+        matrix.set_bounds(i, bounds[i].first, bounds[i].second);
+      }
+    }
+    return true;
+  }
+};
+
+#endif
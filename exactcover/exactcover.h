@@ -1,153 +1,2401 @@
 // Exact Cover solution using Dancing Links
 // Ricardo Bittencourt 2008
 
+#ifndef EXACTCOVER_H
+#define EXACTCOVER_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <deque>
+#include <initializer_list>
+#include <iostream>
 #include <limits>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <type_traits>
 #include <vector>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
+// The matrix is stored as in Knuth's dlx1: all nodes live in a single
+// array and link to each other by index. Nodes 1..w are the item headers,
+// and each option is a contiguous run of nodes preceded by a spacer.
+// A spacer has top <= 0, its up points to the first node of the previous
+// option and its down to the last node of the next one.
 struct node {
-  int size, name;
-  node *left, *right, *up, *down, *top;
-  node(): size(0) {}
+  int top, up, down;
+};
+
+// Active primary items form a doubly linked list headed by the root
+// item 0, and secondary items another one headed by item w + 1. The size
+// of item i is kept in the top field of its header node i.
+struct item {
+  int left, right;
 };
 
 typedef std::vector<bool> vb;
 typedef std::vector<vb> vvb;
 
+// Sparse exact cover matrix, built one option at a time from the list of
+// items it covers. Memory and build time scale with the number of 1s.
+// The last secondary items may be covered at most once instead of
+// exactly once, or may be given a color in each option (see _colorcover).
+// Options with no primary item are never chosen.
+struct sparse_matrix {
+  int w, secondary;
+  std::vector<int> items, start;
+  // Parallel to items, 0 meaning no color. Empty if no option has colors.
+  std::vector<int> colors;
+  // Multiplicities of the primary items, see _multicover. Empty if every
+  // item is covered exactly once.
+  std::vector<int> lo, hi;
+  // Nonnegative option costs, see _costcover. Options past the end are free.
+  std::vector<int> costs;
+  // Items seen by add_option, stamped with the call that saw them last.
+  std::vector<int> stamps;
+  int stamp = 0;
+
+  explicit sparse_matrix(int primary, int secondary_ = 0)
+      : w(primary + secondary_), secondary(secondary_), start(1, 0) {}
+
+  explicit sparse_matrix(const vvb& mat)
+      : sparse_matrix(mat.empty() ? 0 : mat[0].size()) {
+    for (const vb& row : mat) {
+      for (int j = 0; j < w; j++) {
+        if (row[j]) {
+          items.push_back(j);
+        }
+      }
+      start.push_back(items.size());
+    }
+  }
+
+  // Returns false, adding nothing, if an item is out of range or
+  // appears twice, which would corrupt the links of the engines.
+  template<typename It>
+  bool add_option(It begin, It end) {
+    if (int(stamps.size()) < w) {
+      stamps.assign(w, 0);
+    }
+    stamp++;
+    for (It it = begin; it != end; ++it) {
+      if (*it < 0 || *it >= w || stamps[*it] == stamp) {
+        return false;
+      }
+      stamps[*it] = stamp;
+    }
+    items.insert(items.end(), begin, end);
+    start.push_back(items.size());
+    if (!colors.empty()) {
+      colors.resize(items.size(), 0);
+    }
+    return true;
+  }
+
+  // Colors are positive and only allowed on secondary items, 0 meaning
+  // no color. Returns false, adding nothing, if there isn't one color per
+  // item or a color is misplaced.
+  bool add_option(const std::vector<int>& option,
+                  const std::vector<int>& option_colors) {
+    if (option_colors.size() != option.size()) {
+      return false;
+    }
+    for (size_t k = 0; k < option.size(); k++) {
+      if (option_colors[k] < 0 ||
+          (option_colors[k] > 0 && option[k] < primary())) {
+        return false;
+      }
+    }
+    size_t before = items.size();
+    if (!add_option(option.begin(), option.end())) {
+      return false;
+    }
+    colors.resize(before, 0);
+    colors.insert(colors.end(), option_colors.begin(), option_colors.end());
+    return true;
+  }
+
+  bool add_option(std::initializer_list<int> option) {
+    return add_option(option.begin(), option.end());
+  }
+
+  bool add_option(const std::vector<int>& option) {
+    return add_option(option.begin(), option.end());
+  }
+
+  int options() const {
+    return start.size() - 1;
+  }
+
+  int primary() const {
+    return w - secondary;
+  }
+
+  int color(int k) const {
+    return colors.empty() ? 0 : colors[k];
+  }
+
+  // Primary item i must be covered between lo_ and hi_ >= 1 times.
+  void set_bounds(int i, int lo_, int hi_) {
+    if (lo.empty()) {
+      lo.assign(w, 1);
+      hi.assign(w, 1);
+    }
+    lo[i] = lo_;
+    hi[i] = hi_;
+  }
+
+  void set_cost(int option, int cost_) {
+    if (int(costs.size()) <= option) {
+      costs.resize(option + 1, 0);
+    }
+    costs[option] = cost_;
+  }
+
+  int cost(int option) const {
+    return option < int(costs.size()) ? costs[option] : 0;
+  }
+};
+
+// What preprocess found out about a matrix.
+struct reduction {
+  // Options in no solution, which were emptied.
+  std::vector<int> removed;
+  // Options in every solution, being the only one left for some item.
+  std::vector<int> forced;
+  // Some primary item has no option, so there are no solutions at all.
+  bool infeasible = false;
+  int passes = 0;
+};
+
+// Native version of Knuth's dlx-pre. Repeatedly removes the options that
+// would leave some primary item with no compatible option, until nothing
+// changes. This includes the options clashing with the only option of an
+// item. Removed options are emptied, so the others keep their numbers and
+// the solutions are the same. Matrices with multiplicities are left alone.
+inline reduction preprocess(sparse_matrix& mat) {
+  reduction result;
+  int h = mat.options(), primary = mat.primary();
+  if (!mat.lo.empty()) {
+    return result;
+  }
+  std::vector<std::vector<int>> lists(mat.w);
+  for (int o = 0; o < h; o++) {
+    for (int k = mat.start[o]; k < mat.start[o + 1]; k++) {
+      lists[mat.items[k]].push_back(o);
+    }
+  }
+  std::vector<bool> alive(h, true);
+  std::vector<int> len(primary);
+  for (int i = 0; i < primary; i++) {
+    len[i] = lists[i].size();
+    result.infeasible |= len[i] == 0;
+  }
+  // Stamps tell which items are in the current option and which options
+  // and items were already seen for it.
+  std::vector<int> item_stamp(mat.w, -1);
+  std::vector<int> option_stamp(h, -1), blocked_stamp(primary, -1);
+  std::vector<int> blocked(primary, 0);
+  int stamp = 0;
+  bool changed = !result.infeasible;
+  while (changed) {
+    changed = false;
+    result.passes++;
+    for (int o = 0; o < h && !result.infeasible; o++) {
+      if (!alive[o]) {
+        continue;
+      }
+      stamp++;
+      for (int k = mat.start[o]; k < mat.start[o + 1]; k++) {
+        item_stamp[mat.items[k]] = stamp;
+      }
+      bool useless = false;
+      for (int k = mat.start[o]; k < mat.start[o + 1] && !useless; k++) {
+        int j = mat.items[k], color = mat.color(k);
+        for (int p : lists[j]) {
+          if (p == o || !alive[p] || option_stamp[p] == stamp) {
+            continue;
+          }
+          if (j >= primary && color != 0) {
+            int other = 0;
+            for (int q = mat.start[p]; q < mat.start[p + 1]; q++) {
+              if (mat.items[q] == j) {
+                other = mat.color(q);
+              }
+            }
+            if (other == color) {
+              continue;
+            }
+          }
+          option_stamp[p] = stamp;
+          for (int q = mat.start[p]; q < mat.start[p + 1]; q++) {
+            int i = mat.items[q];
+            if (i >= primary || item_stamp[i] == stamp) {
+              continue;
+            }
+            if (blocked_stamp[i] != stamp) {
+              blocked_stamp[i] = stamp;
+              blocked[i] = 0;
+            }
+            if (++blocked[i] == len[i]) {
+              useless = true;
+            }
+          }
+          if (useless) {
+            break;
+          }
+        }
+      }
+      if (useless) {
+        alive[o] = false;
+        result.removed.push_back(o);
+        changed = true;
+        for (int k = mat.start[o]; k < mat.start[o + 1]; k++) {
+          int i = mat.items[k];
+          if (i < primary && --len[i] == 0) {
+            result.infeasible = true;
+          }
+        }
+      }
+    }
+  }
+  std::sort(result.removed.begin(), result.removed.end());
+  for (int i = 0; i < primary && !result.infeasible; i++) {
+    if (len[i] == 1) {
+      for (int o : lists[i]) {
+        if (alive[o]) {
+          result.forced.push_back(o);
+        }
+      }
+    }
+  }
+  std::sort(result.forced.begin(), result.forced.end());
+  result.forced.erase(
+      std::unique(result.forced.begin(), result.forced.end()),
+      result.forced.end());
+  if (!result.removed.empty()) {
+    std::vector<int> items, start(1, 0), colors;
+    for (int o = 0; o < h; o++) {
+      if (alive[o]) {
+        for (int k = mat.start[o]; k < mat.start[o + 1]; k++) {
+          items.push_back(mat.items[k]);
+          if (!mat.colors.empty()) {
+            colors.push_back(mat.colors[k]);
+          }
+        }
+      }
+      start.push_back(items.size());
+    }
+    mat.items.swap(items);
+    mat.start.swap(start);
+    mat.colors.swap(colors);
+  }
+  return result;
+}
+
+// Callbacks either return void, or return bool where false stops the
+// search. Returns whether the search should go on.
+template<typename T>
+bool report_solution(T& callback, const std::vector<int>& solution) {
+  if constexpr (std::is_same_v<
+      std::invoke_result_t<T&, const std::vector<int>&>, bool>) {
+    return callback(solution);
+  } else {
+    callback(solution);
+    return true;
+  }
+}
+
+// Counts solutions, stopping at limit if given. A limit of 2 is enough
+// to check whether a puzzle is unique.
 struct count_solutions {
-  int total;
-  count_solutions(): total(0) {}
-  void operator()(const std::vector<int>&) {
+  int total, limit;
+  count_solutions(int limit_ = 0): total(0), limit(limit_) {}
+  bool operator()(const std::vector<int>&) {
     total++;
+    return limit == 0 || total < limit;
   }
 };
 
-template<typename T>
+// Branching policies pick the item to branch on. choose returns an
+// active primary item, or 0 if there is none, and skip(col) tells
+// whether the remaining options of col can be skipped once one of them
+// led to a solution. User policies can derive from mrv and override
+// either of them.
+struct mrv {
+  // Fewest options, leftmost on ties.
+  template<typename C>
+  int choose(const C& cover) {
+    int minvalue = std::numeric_limits<int>::max();
+    int mincol = 0;
+    for (int c = cover.items[0].right; c != 0; c = cover.items[c].right) {
+      if (cover.nodes[c].top < minvalue) {
+        minvalue = cover.nodes[c].top;
+        mincol = c;
+      }
+    }
+    return mincol;
+  }
+
+  bool skip(int) const {
+    return false;
+  }
+};
+
+// Knuth's sharp heuristic from dlx2.sharp. The first sharps primary
+// items are preferred over the others unless some item has at most one
+// option left. With skip_solutions, as in dlx2.skip, the search backs up
+// to the last sharp item once a solution is found, so each choice of
+// options for the sharp items is reported once.
+struct sharp_first : mrv {
+  int sharps;
+  bool skip_solutions;
+  explicit sharp_first(int sharps_, bool skip_solutions_ = false)
+      : sharps(sharps_), skip_solutions(skip_solutions_) {}
+
+  template<typename C>
+  int choose(const C& cover) {
+    long long minvalue = std::numeric_limits<long long>::max();
+    int mincol = 0;
+    for (int c = cover.items[0].right; c != 0; c = cover.items[c].right) {
+      long long len = cover.nodes[c].top;
+      if (c > sharps && len > 1) {
+        len += std::numeric_limits<int>::max();
+      }
+      if (len < minvalue) {
+        minvalue = len;
+        mincol = c;
+      }
+    }
+    return mincol;
+  }
+
+  bool skip(int col) const {
+    return skip_solutions && col > sharps;
+  }
+};
+
+// Always the leftmost active item. Searches the items in a fixed order,
+// which is what makes memoized counting work on boards, where the active
+// items are then a frontier.
+struct first_item : mrv {
+  template<typename C>
+  int choose(const C& cover) const {
+    return cover.items[0].right;
+  }
+};
+
+// Fewest options, breaking ties uniformly at random.
+struct random_tiebreak : mrv {
+  std::mt19937 rng;
+  explicit random_tiebreak(unsigned seed = 0): rng(seed) {}
+
+  template<typename C>
+  int choose(const C& cover) {
+    int minvalue = std::numeric_limits<int>::max();
+    int mincol = 0, ties = 0;
+    for (int c = cover.items[0].right; c != 0; c = cover.items[c].right) {
+      if (cover.nodes[c].top < minvalue) {
+        minvalue = cover.nodes[c].top;
+        mincol = c;
+        ties = 1;
+      } else if (cover.nodes[c].top == minvalue && rng() % ++ties == 0) {
+        mincol = c;
+      }
+    }
+    return mincol;
+  }
+};
+
+// Search statistics are a template parameter, so they compile out when
+// not used. Mems are counted roughly as in Knuth's dlx1: one per node or
+// item read, one per link written.
+struct no_stats {
+  void mems(int) {}
+  void enter(int) {}
+  template<typename C>
+  void choose(const C&) {}
+  void branch(int, int) {}
+  void next(int) {}
+  void solution() {}
+};
+
+// Counts mems, nodes per level and solutions. If delta is set, prints a
+// progress line to stderr every delta mems, with the branch profile: the
+// option being tried out of how many at each level, and an estimate of
+// how much of the tree was already searched.
+struct search_stats {
+  long long mem, nodes, solutions, delta, reported;
+  std::vector<long long> profile;
+  // Levels below depth are trying option choice out of options.
+  int depth;
+  std::vector<int> choice, options;
+
+  explicit search_stats(long long delta_ = 0)
+      : mem(0), nodes(0), solutions(0), delta(delta_), reported(0),
+        depth(0) {}
+
+  void mems(int count) {
+    mem += count;
+    if (delta > 0 && mem - reported >= delta) {
+      reported += delta;
+      progress(std::cerr);
+    }
+  }
+
+  void enter(int level) {
+    nodes++;
+    depth = level;
+    if (int(profile.size()) <= level) {
+      profile.resize(level + 1, 0);
+      choice.resize(level + 1, 0);
+      options.resize(level + 1, 0);
+    }
+    profile[level]++;
+  }
+
+  // The policy reads every active item once.
+  template<typename C>
+  void choose(const C& cover) {
+    for (int c = cover.items[0].right; c != 0; c = cover.items[c].right) {
+      mem += 2;
+    }
+  }
+
+  void branch(int level, int count) {
+    choice[level] = 0;
+    options[level] = count;
+  }
+
+  void next(int level) {
+    choice[level]++;
+    depth = level + 1;
+  }
+
+  void solution() {
+    solutions++;
+  }
+
+  // Fraction of the tree to the left of the current branch, assuming
+  // every option at a level leads to a subtree of the same size.
+  double done() const {
+    double fraction = 0, scale = 1;
+    for (int i = 0; i < depth; i++) {
+      fraction += scale * (choice[i] - 1) / options[i];
+      scale /= options[i];
+    }
+    return fraction + scale / 2;
+  }
+
+  void progress(std::ostream& out) const {
+    out << mem << " mems, " << nodes << " nodes, " << solutions
+        << " sols, " << done() << " done:";
+    for (int i = 0; i < depth; i++) {
+      out << " " << choice[i] << "/" << options[i];
+    }
+    out << "\n";
+  }
+
+  // Totals and nodes per level.
+  void report(std::ostream& out) const {
+    out << mem << " mems, " << nodes << " nodes, " << solutions << " sols\n";
+    for (int i = 0; i < int(profile.size()); i++) {
+      out << "level " << i << ": " << profile[i] << "\n";
+    }
+  }
+};
+
+// Result of _exactcover::estimate. Each value comes with the half width
+// of its 95% confidence interval.
+struct tree_estimate {
+  int probes;
+  double nodes, nodes_error;
+  double mems, mems_error;
+  double solutions, solutions_error;
+};
+
+// Links the items from first to last into a list headed by root.
+inline void link_items(std::vector<item>& items, int root, int first,
+                       int last) {
+  items[root].left = last >= first ? last : root;
+  items[root].right = last >= first ? first : root;
+  for (int i = first; i <= last; i++) {
+    items[i].left = i == first ? root : i - 1;
+    items[i].right = i == last ? root : i + 1;
+  }
+}
+
+// Builds the item lists and the nodes of a dancing links engine from a
+// matrix, linking the options in the given order if any. Nodes start
+// zeroed. The option of each node goes to node_option, and the first
+// node of each option to option_nodes, or 0 if it's empty.
+template<typename Node>
+void link_matrix(const sparse_matrix& mat, const std::vector<int>& order,
+                 std::vector<item>& items, std::vector<Node>& nodes,
+                 std::vector<int>& node_option,
+                 std::vector<int>& option_nodes) {
+  int w = mat.w, h = mat.options(), primary = mat.primary();
+  int options = 0;
+  for (int i = 0; i < h; i++) {
+    options += mat.start[i + 1] > mat.start[i];
+  }
+  items.resize(w + 2);
+  link_items(items, 0, 1, primary);
+  link_items(items, w + 1, primary + 1, w);
+  nodes.assign(w + 1 + mat.items.size() + options + 1, Node());
+  node_option.assign(nodes.size(), 0);
+  option_nodes.assign(h, 0);
+  for (int i = 0; i <= w; i++) {
+    nodes[i].up = nodes[i].down = i;
+  }
+  int spacer = w + 1, last = spacer;
+  for (int t = 0; t < h; t++) {
+    int i = order.empty() ? t : order[t];
+    if (mat.start[i + 1] == mat.start[i]) {
+      continue;
+    }
+    int first = last + 1;
+    for (int k = mat.start[i]; k < mat.start[i + 1]; k++) {
+      int current = ++last, col = mat.items[k] + 1;
+      node_option[current] = i;
+      nodes[current].top = col;
+      nodes[current].down = col;
+      nodes[current].up = nodes[col].up;
+      nodes[nodes[col].up].down = current;
+      nodes[col].up = current;
+      nodes[col].top++;
+    }
+    option_nodes[i] = first;
+    // The spacer before an option stores its name.
+    nodes[spacer].top = -i;
+    nodes[spacer].down = last;
+    spacer = ++last;
+    nodes[spacer].up = first;
+  }
+  nodes[spacer].top = -h;
+}
+
+template<typename T, typename Policy = mrv, typename Stats = no_stats>
 struct _exactcover {
-  int w, h;
+  int w, h, primary;
   T& callback;
+  Policy policy;
+  Stats stats;
+  // Stop after this many solutions, or never if zero.
+  int max_solutions;
+  int found;
   std::vector<int> solution;
-  node *root;
+  std::vector<item> items;
+  std::vector<node> nodes;
+  // Option of each node, so that its name is found without walking back
+  // to the spacer.
+  std::vector<int> node_option;
+  // First node of each option, or 0 if it's empty, and the first nodes
+  // of the options forced so far.
+  std::vector<int> option_nodes, forced;
+  // If set, the position in the tree is saved to checkpoint_file every
+  // checkpoint_every nodes, see resume. If a checkpoint can't be written
+  // the search stops, and the last one written can still be resumed.
+  std::string checkpoint_file;
+  long long checkpoint_every = 0, checkpoint_nodes = 0;
+  // Option names still to be replayed by resume, one per level.
+  std::vector<int> resume_path;
+  bool resuming = false;
+  // Set when the saved path doesn't lead anywhere in this search.
+  bool resume_lost = false;
+  // Levels above this one only search the option on the saved path, so
+  // the search stays inside the subtree at that depth. Zero unless a
+  // work unit is resumed.
+  int subtree_depth = 0;
+  // If set, the search unwinds as soon as it becomes true, as if the
+  // callback had returned false. Lets another thread stop this one.
+  const std::atomic<bool>* stop = nullptr;
+
+  _exactcover(const vvb& mat, T& callback_, Policy policy_ = Policy())
+      : _exactcover(sparse_matrix(mat), callback_, policy_) {
+  }
 
-  _exactcover(const vvb& mat, T& callback_)
-      : w(mat[0].size()), h(mat.size()), callback(callback_)
+  _exactcover(const sparse_matrix& mat, T& callback_,
+              Policy policy_ = Policy())
+      : w(mat.w), h(mat.options()), primary(mat.primary()),
+        callback(callback_), policy(policy_), max_solutions(0), found(0)
   {
-    root = getnode();
-    root->left = root;
-    root->right = root;
-    root->name = -1000000;
-    std::vector<node*> head(w);
-    for (int i = 0; i < w; i++) {
-      node* next = head[i] = getnode();
-      next->right = root;
-      next->left = root->left;
-      root->left = next;
-      next->left->right = next;
-      next->up = next;
-      next->down = next;
-      next->name = -i-1;
+    link_matrix(mat, {}, items, nodes, node_option, option_nodes);
+  }
+
+  // Copies the links of another instance, reporting to a new callback.
+  _exactcover(const _exactcover& other, T& callback_)
+      : w(other.w), h(other.h), primary(other.primary), callback(callback_),
+        policy(other.policy), stats(other.stats),
+        max_solutions(other.max_solutions), found(0),
+        solution(other.solution), items(other.items), nodes(other.nodes),
+        node_option(other.node_option), option_nodes(other.option_nodes),
+        forced(other.forced) {
+  }
+
+  int option_name(int p) const {
+    return node_option[p];
+  }
+
+  void hide(int p) {
+    for (int q = p + 1; q != p;) {
+      int x = nodes[q].top, u = nodes[q].up, d = nodes[q].down;
+      if (x <= 0) {
+        stats.mems(1);
+        q = u;
+      } else {
+        stats.mems(4);
+        nodes[u].down = d;
+        nodes[d].up = u;
+        nodes[x].top--;
+        q++;
+      }
     }
-    for (int i = 0; i < h; i++) {
-      node* root = NULL;
-      for (int j = 0; j < w; j++) {
-        if (mat[i][j]) {
-          node* current;
-          if (root == NULL) {
-            current = root = getnode();
-            root->left = root;
-            root->right = root;
-          } else {
-            node* next = current = getnode();
-            next->right = root;
-            next->left = root->left;
-            root->left = next;
-            next->left->right = next;
-          }
-          current->down = head[j];
-          current->up = head[j]->up;
-          head[j]->up = current;
-          current->up->down = current;
-          current->top = head[j];
-          current->name = i;
-          head[j]->size++;
+  }
+
+  void unhide(int p) {
+    for (int q = p - 1; q != p;) {
+      int x = nodes[q].top, u = nodes[q].up, d = nodes[q].down;
+      if (x <= 0) {
+        stats.mems(1);
+        q = d;
+      } else {
+        stats.mems(4);
+        nodes[u].down = q;
+        nodes[d].up = q;
+        nodes[x].top++;
+        q--;
+      }
+    }
+  }
+
+  void cover(int col) {
+    stats.mems(3);
+    int l = items[col].left, r = items[col].right;
+    items[l].right = r;
+    items[r].left = l;
+    for (int p = nodes[col].down; p != col; p = nodes[p].down) {
+      stats.mems(1);
+      hide(p);
+    }
+  }
+
+  void uncover(int col) {
+    stats.mems(3);
+    for (int p = nodes[col].up; p != col; p = nodes[p].up) {
+      stats.mems(1);
+      unhide(p);
+    }
+    int l = items[col].left, r = items[col].right;
+    items[l].right = col;
+    items[r].left = col;
+  }
+
+  // Covers the other items of the option containing node r.
+  void cover_option(int r) {
+    for (int p = r + 1; p != r;) {
+      int j = nodes[p].top;
+      stats.mems(1);
+      if (j <= 0) {
+        p = nodes[p].up;
+      } else {
+        cover(j);
+        p++;
+      }
+    }
+  }
+
+  void uncover_option(int r) {
+    for (int p = r - 1; p != r;) {
+      int j = nodes[p].top;
+      stats.mems(1);
+      if (j <= 0) {
+        p = nodes[p].down;
+      } else {
+        uncover(j);
+        p--;
+      }
+    }
+  }
+
+  int choose() {
+    stats.choose(*this);
+    return policy.choose(*this);
+  }
+
+  // Returns false if the search was stopped early. The links are
+  // restored either way, so the instance can be solved again.
+  bool solve(void) {
+    found = 0;
+    return search();
+  }
+
+  // Solves with the givens forced on top of the options already forced,
+  // and releases them afterwards. Givens that clash have no solutions.
+  bool solve(const std::vector<int>& givens) {
+    size_t before = forced.size();
+    if (!force(givens)) {
+      found = 0;
+      return true;
+    }
+    bool running = solve();
+    release(before);
+    return running;
+  }
+
+  // Whether all the items of the option containing node r are still
+  // there, so it can be chosen.
+  bool available(int r) const {
+    for (int p = r;;) {
+      int j = nodes[p].top;
+      if (j <= 0) {
+        p = nodes[p].up;
+      } else {
+        if (items[items[j].left].right != j) {
+          return false;
         }
+        p++;
+      }
+      if (p == r) {
+        return true;
       }
     }
   }
 
-  ~_exactcover() {
-    for (node* i = root->right; i != root;) {
-      for (node* j = i->down; j != i;) {
-	j = j->down;
-	delete j->up;;
+  // Chooses the given options before the search, as clues, so one
+  // instance can be solved for many sets of clues without building it
+  // again. They are part of every solution. Returns false, forcing
+  // nothing, if they clash with each other or with the options already
+  // forced.
+  bool force(const std::vector<int>& options) {
+    size_t before = forced.size();
+    for (int option : options) {
+      int r = option >= 0 && option < h ? option_nodes[option] : 0;
+      if (r == 0 || !available(r)) {
+        release(before);
+        return false;
       }
-      i = i->right;
-      delete i->left;
+      apply({r});
+      forced.push_back(r);
     }
-    delete root;
+    return true;
   }
 
-  node* getnode() {
-    return new node;
+  // Undoes the forced options past the first keep of them.
+  void release(size_t keep = 0) {
+    while (forced.size() > keep) {
+      unapply({forced.back()});
+      forced.pop_back();
+    }
   }
 
-  void cover(node* col) {
-    col->right->left = col->left;
-    col->left->right = col->right;
-    for (node* i = col->down; i != col; i = i->down) {
-      for (node* j = i->right; j != i; j = j->right) {
-        j->down->up = j->up;
-        j->up->down = j->down;
-        j->top->size--;
+  // The problem can be changed between solves, as long as no options
+  // are forced. Each change costs time proportional to its size, except
+  // add_item, which moves every node.
+
+  // Adds an option with the given items, numbered as in sparse_matrix,
+  // and returns its name, the next one after the existing options.
+  // Returns -1 if an item doesn't exist or is given twice.
+  int add_option(const std::vector<int>& option) {
+    for (auto it = option.begin(); it != option.end(); ++it) {
+      int i = *it, j = i + 1;
+      if (!forced.empty() || i < 0 || i >= w ||
+          items[items[j].left].right != j ||
+          std::find(option.begin(), it, i) != it) {
+        return -1;
       }
     }
+    int spacer = nodes.size() - 1, first = nodes.size();
+    nodes[spacer].top = -h;
+    option_nodes.push_back(option.empty() ? 0 : first);
+    for (int i : option) {
+      int current = nodes.size(), col = i + 1;
+      nodes.push_back(node{col, nodes[col].up, col});
+      node_option.push_back(h);
+      nodes[nodes[col].up].down = current;
+      nodes[col].up = current;
+      nodes[col].top++;
+    }
+    nodes[spacer].down = nodes.size() - 1;
+    nodes.push_back(node{-(h + 1), first, 0});
+    node_option.push_back(0);
+    return h++;
+  }
+
+  // Takes an option out for good. Its name is not reused.
+  bool remove_option(int option) {
+    if (!forced.empty() || option < 0 || option >= h ||
+        option_nodes[option] == 0) {
+      return false;
+    }
+    for (int q = option_nodes[option]; nodes[q].top > 0; q++) {
+      int x = nodes[q].top, u = nodes[q].up, d = nodes[q].down;
+      nodes[u].down = d;
+      nodes[d].up = u;
+      nodes[x].top--;
+    }
+    option_nodes[option] = 0;
+    return true;
   }
 
-  void uncover(node* col) {
-    for (node* i = col->up; i != col; i = i->up) {
-      for (node* j = i->left; j != i; j = j->left) {
-        j->top->size++;
-        j->up->down = j;
-        j->down->up = j;
+  // Adds an item with no options and returns its number. A primary item
+  // goes after the other primary items, so the secondary items move up
+  // by one.
+  int add_item(bool secondary = false) {
+    if (!forced.empty()) {
+      return -1;
+    }
+    int pos = secondary ? w + 1 : primary + 1;
+    auto shift = [pos](int& x) {
+      if (x >= pos) {
+        x++;
+      }
+    };
+    for (int p = 0; p < int(nodes.size()); p++) {
+      shift(nodes[p].up);
+      shift(nodes[p].down);
+      if (p > w) {
+        shift(nodes[p].top);
+      }
+    }
+    nodes.insert(nodes.begin() + pos, node{0, pos, pos});
+    node_option.insert(node_option.begin() + pos, 0);
+    for (item& it : items) {
+      shift(it.left);
+      shift(it.right);
+    }
+    items.insert(items.begin() + pos, item{0, 0});
+    for (int& first : option_nodes) {
+      if (first != 0) {
+        shift(first);
       }
     }
-    col->right->left = col;
-    col->left->right = col;
+    w++;
+    primary += !secondary;
+    int root = secondary ? w + 1 : 0, last = items[root].left;
+    items[pos] = item{last, root};
+    items[last].right = pos;
+    items[root].left = pos;
+    return pos - 1;
   }
 
-  void solve(void) {
-    if (root->right == root) {
-      callback(solution);
-      return;
+  // Takes out an item that no option uses any more, so it doesn't have
+  // to be covered. Its number stays taken.
+  bool remove_item(int i) {
+    int col = i + 1;
+    if (!forced.empty() || i < 0 || i >= w || nodes[col].top != 0 ||
+        items[items[col].left].right != col) {
+      return false;
     }
+    int l = items[col].left, r = items[col].right;
+    items[l].right = r;
+    items[r].left = l;
+    return true;
+  }
 
-    int minvalue = std::numeric_limits<int>::max();
-    node* mincol = root;
-    for (node* n = root->right; n != root; n = n->right) {
-      if (n->size < minvalue) {
-        minvalue = n->size;
-        mincol = n;
+  bool search(void) {
+    if (stop != nullptr && stop->load(std::memory_order_relaxed)) {
+      return false;
+    }
+    int level = solution.size();
+    stats.enter(level);
+    if (resuming && level == int(resume_path.size())) {
+      resuming = false;
+    }
+    if (checkpoint_every > 0 && !resuming &&
+        ++checkpoint_nodes >= checkpoint_every) {
+      checkpoint_nodes = 0;
+      if (!save_checkpoint()) {
+        std::cerr << "can't write checkpoint " << checkpoint_file << "\n";
+        return false;
       }
     }
-    if (minvalue == 0)
-      return;
+    // A saved path that ends early was made for another matrix or
+    // policy.
+    if (resuming && items[0].right == 0) {
+      resume_lost = true;
+      return false;
+    }
+    if (items[0].right == 0) {
+      found++;
+      stats.solution();
+      return report_solution(callback, solution) &&
+          (max_solutions == 0 || found < max_solutions);
+    }
 
+    int mincol = choose();
+    if (nodes[mincol].top == 0) {
+      resume_lost = resuming;
+      return !resuming;
+    }
+
+    bool running = true;
+    stats.branch(level, nodes[mincol].top);
     cover(mincol);
-    for (node* r = mincol->down; r != mincol; r = r->down) {
-      for (node* j = r->right; j != r; j = j->right)
-        cover(j->top);
-      solution.push_back(r->name);
-      solve();
+    int r = nodes[mincol].down;
+    if (resuming) {
+      // Everything to the left of the saved path was already searched.
+      while (r != mincol && option_name(r) != resume_path[level]) {
+        stats.next(level);
+        r = nodes[r].down;
+      }
+      if (r == mincol) {
+        uncover(mincol);
+        resume_lost = true;
+        return false;
+      }
+    }
+    for (; running && r != mincol; r = nodes[r].down) {
+      int before = found;
+      stats.next(level);
+      cover_option(r);
+      solution.push_back(option_name(r));
+      running = search();
       solution.pop_back();
-      for (node* j = r->left; j != r; j = j->left)
-        uncover(j->top);
+      uncover_option(r);
+      if (found > before && policy.skip(mincol)) {
+        break;
+      }
+      if (level < subtree_depth) {
+        break;
+      }
     }
     uncover(mincol);
+    return running;
   }
 
-};
+  // Calls emit with every path of chosen nodes that reaches the given
+  // depth, or a solution before that. Dead ends are not reported.
+  template<typename F>
+  void split(int depth, std::vector<int>& path, F& emit) {
+    if (items[0].right == 0 || int(path.size()) == depth) {
+      emit(path);
+      return;
+    }
+    int mincol = choose();
+    if (nodes[mincol].top == 0)
+      return;
+    cover(mincol);
+    for (int r = nodes[mincol].down; r != mincol; r = nodes[r].down) {
+      cover_option(r);
+      path.push_back(r);
+      split(depth, path, emit);
+      path.pop_back();
+      uncover_option(r);
+    }
+    uncover(mincol);
+  }
 
-template<class T>
-void exactcover(const vvb& mat, T callback) {
-  _exactcover<T> cover(mat, callback);
-  cover.solve();
-}
+  // Saves the number of solutions found and the names of the options
+  // chosen so far, then the depth of the work unit if this is one. The
+  // subtree below this point and everything to its right are still to be
+  // searched. The file is replaced by a rename, so a crash never leaves it
+  // half written.
+  bool save_checkpoint() const {
+    std::string temp = checkpoint_file + ".tmp";
+    {
+      std::ofstream out(temp);
+      out << found << " " << solution.size();
+      for (int name : solution) {
+        out << " " << name;
+      }
+      if (subtree_depth > 0) {
+        out << " " << subtree_depth;
+      }
+      out << "\n";
+      if (!out) {
+        out.close();
+        std::remove(temp.c_str());
+        return false;
+      }
+    }
+    return std::rename(temp.c_str(), checkpoint_file.c_str()) == 0;
+  }
+
+  // Continues the search saved in a checkpoint file, or in a file made
+  // by hand to start at a given subtree. Solutions found after the file
+  // was written are reported again. The policy must be deterministic.
+  //
+  // The saved path is followed by everything to its right, unless
+  // subtree is set or the file ends with a depth, as the checkpoints of
+  // a work unit do. Then the search stays inside the subtree at that
+  // depth of the path, so hand-written files with different paths split
+  // the tree among machines. Returns false if the file can't be read,
+  // its path is not in this search, or the search was stopped.
+  bool resume(const std::string& file, bool subtree = false) {
+    std::ifstream in(file);
+    int depth = 0;
+    if (!(in >> found >> depth) || depth < 0) {
+      return false;
+    }
+    resume_path.resize(depth);
+    for (int& name : resume_path) {
+      if (!(in >> name)) {
+        return false;
+      }
+    }
+    int bound = 0;
+    if (!(in >> bound)) {
+      bound = 0;
+    }
+    if (subtree) {
+      bound = depth;
+    }
+    if (bound < 0 || bound > depth) {
+      return false;
+    }
+    subtree_depth = bound;
+    resuming = true;
+    resume_lost = false;
+    bool running = search();
+    resuming = false;
+    subtree_depth = 0;
+    if (resume_lost) {
+      std::cerr << "checkpoint " << file << " doesn't match this search\n";
+      return false;
+    }
+    return running;
+  }
+
+  // Sum of the item sizes, which drops by one for every node hidden.
+  long long total_size() const {
+    long long total = 0;
+    for (int i = 1; i <= w; i++) {
+      total += nodes[i].top;
+    }
+    return total;
+  }
+
+  // Knuth's estimate of the size of the search tree. Each probe walks
+  // from the root taking a random option at every node, choosing items
+  // as search does. A node at depth k stands for the product of the
+  // branching degrees above it, which makes the averages unbiased. Mems
+  // are counted as in search_stats, from the item sizes before and after
+  // each cover, with the option taken standing in for all its siblings.
+  // The probes run with fresh stats, so they don't count towards those
+  // of the search or print progress lines.
+  tree_estimate estimate(int probes, unsigned seed = 0) {
+    Stats saved = stats;
+    stats = Stats();
+    std::mt19937 rng(seed);
+    double sum[3] = {0, 0, 0}, squares[3] = {0, 0, 0};
+    std::vector<int> path;
+    for (int t = 0; t < probes; t++) {
+      double weight = 1, sample[3] = {0, 0, 0};
+      while (true) {
+        sample[0] += weight;
+        if (items[0].right == 0) {
+          sample[2] += weight;
+          break;
+        }
+        double cost = 0;
+        for (int c = items[0].right; c != 0; c = items[c].right) {
+          cost += 2;
+        }
+        int col = choose(), degree = nodes[col].top;
+        if (degree == 0) {
+          sample[1] += weight * cost;
+          break;
+        }
+        long long before = total_size();
+        double covered = 3 + 2 * degree;
+        cover(col);
+        long long middle = total_size();
+        int r = nodes[col].down;
+        for (int k = rng() % degree; k > 0; k--) {
+          r = nodes[r].down;
+        }
+        // The items of the option are covered one at a time, as in
+        // cover_option, so each size is read after the covers before it.
+        double chosen = 1;
+        for (int p = r + 1; p != r;) {
+          int j = nodes[p].top;
+          if (j <= 0) {
+            p = nodes[p].up;
+          } else {
+            chosen += 4 + 2 * nodes[j].top;
+            cover(j);
+            p++;
+          }
+        }
+        covered += 4.0 * (before - middle);
+        chosen += 4.0 * (middle - total_size());
+        cost += 2 * (covered + degree * chosen);
+        sample[1] += weight * cost;
+        path.push_back(r);
+        weight *= degree;
+      }
+      for (int i = int(path.size()) - 1; i >= 0; i--) {
+        uncover_option(path[i]);
+        uncover(nodes[path[i]].top);
+      }
+      path.clear();
+      for (int k = 0; k < 3; k++) {
+        sum[k] += sample[k];
+        squares[k] += sample[k] * sample[k];
+      }
+    }
+    stats = saved;
+    double mean[3], error[3];
+    for (int k = 0; k < 3; k++) {
+      mean[k] = probes > 0 ? sum[k] / probes : 0;
+      double variance = probes > 1 ?
+          (squares[k] - probes * mean[k] * mean[k]) / (probes - 1) : 0;
+      error[k] = probes > 1 ?
+          1.96 * std::sqrt(std::max(variance, 0.0) / probes) : 0;
+    }
+    return tree_estimate{probes, mean[0], error[0], mean[1], error[1],
+                         mean[2], error[2]};
+  }
+
+  // Replays a path found by split, leaving the subproblem below it.
+  void apply(const std::vector<int>& path) {
+    for (int r : path) {
+      cover(nodes[r].top);
+      cover_option(r);
+      solution.push_back(option_name(r));
+    }
+  }
+
+  void unapply(const std::vector<int>& path) {
+    for (int i = int(path.size()) - 1; i >= 0; i--) {
+      solution.pop_back();
+      uncover_option(path[i]);
+      uncover(nodes[path[i]].top);
+    }
+  }
+
+};
+
+template<class T, class Policy = mrv>
+void exactcover(const vvb& mat, T callback, int max_solutions = 0,
+                Policy policy = Policy()) {
+  _exactcover<T, Policy> cover(mat, callback, policy);
+  cover.max_solutions = max_solutions;
+  cover.solve();
+}
+
+template<class T, class Policy = mrv>
+void exactcover(const sparse_matrix& mat, T callback, int max_solutions = 0,
+                Policy policy = Policy()) {
+  _exactcover<T, Policy> cover(mat, callback, policy);
+  cover.max_solutions = max_solutions;
+  cover.solve();
+}
+
+// Number of bits set in a & b, both of the given number of words.
+inline int popcount_and(const uint64_t* a, const uint64_t* b, int words) {
+  int count = 0, k = 0;
+#ifdef __AVX2__
+  // Counts the bits of each nibble with a table lookup, as in Mula's
+  // algorithm, and adds the bytes up with sad.
+  if (words >= 4) {
+    const __m256i table = _mm256_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i total = _mm256_setzero_si256();
+    for (; k + 4 <= words; k += 4) {
+      __m256i x = _mm256_and_si256(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + k)),
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + k)));
+      __m256i bytes = _mm256_add_epi8(
+          _mm256_shuffle_epi8(table, _mm256_and_si256(x, low)),
+          _mm256_shuffle_epi8(
+              table, _mm256_and_si256(_mm256_srli_epi16(x, 4), low)));
+      total = _mm256_add_epi64(
+          total, _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+    }
+    count = _mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1) +
+        _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3);
+  }
+#endif
+  for (; k < words; k++) {
+    count += __builtin_popcountll(a[k] & b[k]);
+  }
+  return count;
+}
+
+// Words of storage for the bitsets of _bitcover. A size of zero means
+// it's only known at run time.
+template<int Size>
+using bit_storage = typename std::conditional<
+    Size == 0, std::vector<uint64_t>, std::array<uint64_t, Size>>::type;
+
+template<typename S>
+inline void clear_bits(std::vector<S>& bits, size_t size) {
+  bits.assign(size, S());
+}
+
+template<typename S, size_t N>
+inline void clear_bits(std::array<S, N>& bits, size_t) {
+  bits.fill(S());
+}
+
+// Exact cover on bitsets, for matrices with at most Items items. Each
+// option keeps the set of options that clash with it, so choosing it just
+// masks them out of the active set of the next level. Gives the same
+// solutions in the same order as _exactcover. Secondary items work, but
+// colors and multiplicities don't.
+//
+// If Options is given, the matrix has at most that many options, and all
+// the storage is in std::arrays sized at compile time, see
+// static_exactcover.
+template<typename T, int Items, int Options = 0>
+struct _bitcover {
+  static constexpr int item_words = (Items + 63) / 64;
+  static constexpr int option_words = (Options + 63) / 64;
+  typedef std::array<uint64_t, item_words> item_set;
+  int w, h, primary, words;
+  T& callback;
+  int max_solutions;
+  int found;
+  std::vector<int> solution;
+  // Items of each option, and the active options of each item and the
+  // options clashing with each option, words at a time.
+  typename std::conditional<Options == 0, std::vector<item_set>,
+                            std::array<item_set, Options>>::type option_items;
+  bit_storage<Items * option_words> item_options;
+  bit_storage<Options * option_words> clashes;
+  // The active options, one set per level. Each level covers at least
+  // one primary item, so there are at most primary + 1 of them.
+  bit_storage<(Items + 2) * option_words> active;
+  item_set open;
+
+  // Words in a set of options, a constant if Options is given.
+  int option_size() const {
+    return Options > 0 ? option_words : words;
+  }
+
+  _bitcover(const sparse_matrix& mat, T& callback_)
+      : w(mat.w), h(mat.options()), primary(mat.primary()),
+        words(Options > 0 ? option_words : (h + 63) / 64),
+        callback(callback_), max_solutions(0), found(0), open() {
+    clear_bits(option_items, h);
+    clear_bits(item_options, w * words);
+    clear_bits(clashes, h * words);
+    clear_bits(active, (primary + 2) * words);
+    for (int o = 0; o < h; o++) {
+      option_items[o].fill(0);
+      for (int k = mat.start[o]; k < mat.start[o + 1]; k++) {
+        int i = mat.items[k];
+        option_items[o][i / 64] |= uint64_t(1) << (i % 64);
+        item_options[i * words + o / 64] |= uint64_t(1) << (o % 64);
+      }
+    }
+    for (int o = 0; o < h; o++) {
+      for (int k = mat.start[o]; k < mat.start[o + 1]; k++) {
+        const uint64_t* options = &item_options[mat.items[k] * words];
+        for (int j = 0; j < words; j++) {
+          clashes[o * words + j] |= options[j];
+        }
+      }
+      if (mat.start[o + 1] > mat.start[o]) {
+        active[o / 64] |= uint64_t(1) << (o % 64);
+      }
+    }
+    for (int i = 0; i < primary; i++) {
+      open[i / 64] |= uint64_t(1) << (i % 64);
+    }
+  }
+
+  // Chooses the open item with fewest active options, leftmost on ties.
+  // Adding the items of the active options into two bit-sliced counters
+  // gives the exact count of every item with at most 3 options, which is
+  // usually enough. Otherwise the counts are found by popcounting.
+  int choose(const uint64_t* current, int& minvalue) const {
+    item_set low{}, high{}, many{};
+    for (int k = 0; k < option_size(); k++) {
+      for (uint64_t bits = current[k]; bits; bits &= bits - 1) {
+        const item_set& add = option_items[k * 64 + __builtin_ctzll(bits)];
+        for (int j = 0; j < item_words; j++) {
+          uint64_t carry = low[j] & add[j];
+          low[j] ^= add[j];
+          many[j] |= high[j] & carry;
+          high[j] ^= carry;
+        }
+      }
+    }
+    item_set few;
+    for (int j = 0; j < item_words; j++) {
+      few[j] = open[j] & ~many[j];
+    }
+    // Keeps the items with a zero bit in the high slice if any, then
+    // the ones with a zero bit in the low slice.
+    for (const item_set* slice : {&high, &low}) {
+      item_set zero;
+      bool found_zero = false;
+      for (int j = 0; j < item_words; j++) {
+        zero[j] = few[j] & ~(*slice)[j];
+        found_zero |= zero[j] != 0;
+      }
+      if (found_zero) {
+        few = zero;
+      }
+    }
+    for (int j = 0; j < item_words; j++) {
+      if (few[j]) {
+        int bit = __builtin_ctzll(few[j]);
+        minvalue = (low[j] >> bit & 1) + 2 * (high[j] >> bit & 1);
+        return j * 64 + bit;
+      }
+    }
+    minvalue = std::numeric_limits<int>::max();
+    int mincol = -1;
+    for (int k = 0; k < item_words; k++) {
+      for (uint64_t bits = open[k]; bits; bits &= bits - 1) {
+        int i = k * 64 + __builtin_ctzll(bits);
+        int count = popcount_and(current, &item_options[i * option_size()],
+                                 option_size());
+        if (count < minvalue) {
+          minvalue = count;
+          mincol = i;
+        }
+      }
+    }
+    return mincol;
+  }
+
+  bool solve(void) {
+    found = 0;
+    return search(0);
+  }
+
+  bool search(int level) {
+    bool done = true;
+    for (int k = 0; k < item_words; k++) {
+      done &= open[k] == 0;
+    }
+    if (done) {
+      found++;
+      return report_solution(callback, solution) &&
+          (max_solutions == 0 || found < max_solutions);
+    }
+
+    const uint64_t* current = &active[level * option_size()];
+    int minvalue, mincol = choose(current, minvalue);
+    if (minvalue == 0)
+      return true;
+
+    bool running = true;
+    const uint64_t* candidates = &item_options[mincol * option_size()];
+    item_set saved = open;
+    for (int k = 0; running && k < option_size(); k++) {
+      for (uint64_t bits = current[k] & candidates[k]; running && bits;
+           bits &= bits - 1) {
+        int o = k * 64 + __builtin_ctzll(bits);
+        uint64_t* next = &active[(level + 1) * option_size()];
+        const uint64_t* clash = &clashes[o * option_size()];
+        for (int j = 0; j < option_size(); j++) {
+          next[j] = current[j] & ~clash[j];
+        }
+        for (int j = 0; j < item_words; j++) {
+          open[j] = saved[j] & ~option_items[o][j];
+        }
+        solution.push_back(o);
+        running = search(level + 1);
+        solution.pop_back();
+      }
+    }
+    open = saved;
+    return running;
+  }
+};
+
+// Uses the bitset kernel when the matrix has at most Items items, like
+// exactcover<144>(mat, callback), and dancing links otherwise.
+template<int Items, class T>
+void exactcover(const sparse_matrix& mat, T callback, int max_solutions = 0) {
+  if (mat.w <= Items && mat.colors.empty() && mat.lo.empty()) {
+    _bitcover<T, Items> cover(mat, callback);
+    cover.max_solutions = max_solutions;
+    cover.solve();
+  } else {
+    exactcover(mat, callback, max_solutions);
+  }
+}
+
+template<int Items, class T>
+void exactcover(const vvb& mat, T callback, int max_solutions = 0) {
+  exactcover<Items>(sparse_matrix(mat), callback, max_solutions);
+}
+
+// The bitset kernel for puzzles of a fixed shape, with at most Options
+// options and Items items, like static_exactcover<216, 144>(mat, callback).
+// Nothing is allocated while solving, and the loops over the sets have
+// constant trip counts. Bigger matrices fall back to exactcover<Items>.
+template<int Options, int Items, class T>
+void static_exactcover(const sparse_matrix& mat, T callback,
+                       int max_solutions = 0) {
+  if (mat.options() <= Options && mat.w <= Items &&
+      mat.colors.empty() && mat.lo.empty()) {
+    _bitcover<T, Items, Options> cover(mat, callback);
+    cover.max_solutions = max_solutions;
+    cover.solve();
+  } else {
+    exactcover<Items>(mat, callback, max_solutions);
+  }
+}
+
+template<int Options, int Items, class T>
+void static_exactcover(const vvb& mat, T callback, int max_solutions = 0) {
+  static_exactcover<Options, Items>(sparse_matrix(mat), callback,
+                                    max_solutions);
+}
+
+// Color-controlled covering, as in Knuth's dlx2. An option may give a
+// color to each of its secondary items, and any number of options may
+// share a secondary item as long as they agree on its color. Choosing an
+// option purifies its colored items, hiding the options that disagree.
+// Nodes already known to agree get color -1 and are left alone by hide.
+struct color_node {
+  int top, up, down, color;
+};
+
+template<typename T, typename Policy = mrv>
+struct _colorcover {
+  int w, h, primary;
+  T& callback;
+  Policy policy;
+  int max_solutions;
+  int found;
+  std::vector<int> solution;
+  std::vector<item> items;
+  std::vector<color_node> nodes;
+  // Option of each node, and first node of each option, as in
+  // _exactcover.
+  std::vector<int> node_option, option_nodes;
+
+  // Options are linked in the given order if any, but keep their names.
+  _colorcover(const sparse_matrix& mat, T& callback_,
+              const std::vector<int>& order = {}, Policy policy_ = Policy())
+      : w(mat.w), h(mat.options()), primary(mat.primary()),
+        callback(callback_), policy(policy_), max_solutions(0), found(0)
+  {
+    link_matrix(mat, order, items, nodes, node_option, option_nodes);
+    for (int i = 0; i < h; i++) {
+      for (int k = mat.start[i]; k < mat.start[i + 1]; k++) {
+        nodes[option_nodes[i] + k - mat.start[i]].color = mat.color(k);
+      }
+    }
+  }
+
+  int option_name(int p) const {
+    return node_option[p];
+  }
+
+  void hide(int p) {
+    for (int q = p + 1; q != p;) {
+      int x = nodes[q].top, u = nodes[q].up, d = nodes[q].down;
+      if (x <= 0) {
+        q = u;
+      } else {
+        if (nodes[q].color >= 0) {
+          nodes[u].down = d;
+          nodes[d].up = u;
+          nodes[x].top--;
+        }
+        q++;
+      }
+    }
+  }
+
+  void unhide(int p) {
+    for (int q = p - 1; q != p;) {
+      int x = nodes[q].top, u = nodes[q].up, d = nodes[q].down;
+      if (x <= 0) {
+        q = d;
+      } else {
+        if (nodes[q].color >= 0) {
+          nodes[u].down = q;
+          nodes[d].up = q;
+          nodes[x].top++;
+        }
+        q--;
+      }
+    }
+  }
+
+  void cover(int col) {
+    for (int p = nodes[col].down; p != col; p = nodes[p].down) {
+      hide(p);
+    }
+    int l = items[col].left, r = items[col].right;
+    items[l].right = r;
+    items[r].left = l;
+  }
+
+  void uncover(int col) {
+    int l = items[col].left, r = items[col].right;
+    items[l].right = col;
+    items[r].left = col;
+    for (int p = nodes[col].up; p != col; p = nodes[p].up) {
+      unhide(p);
+    }
+  }
+
+  void purify(int p) {
+    int col = nodes[p].top, color = nodes[p].color;
+    for (int q = nodes[col].down; q != col; q = nodes[q].down) {
+      if (nodes[q].color != color) {
+        hide(q);
+      } else if (q != p) {
+        nodes[q].color = -1;
+      }
+    }
+  }
+
+  void unpurify(int p) {
+    int col = nodes[p].top, color = nodes[p].color;
+    for (int q = nodes[col].up; q != col; q = nodes[q].up) {
+      if (nodes[q].color < 0) {
+        nodes[q].color = color;
+      } else if (q != p) {
+        unhide(q);
+      }
+    }
+  }
+
+  void cover_option(int r) {
+    for (int p = r + 1; p != r;) {
+      int j = nodes[p].top;
+      if (j <= 0) {
+        p = nodes[p].up;
+      } else {
+        if (nodes[p].color == 0) {
+          cover(j);
+        } else if (nodes[p].color > 0) {
+          purify(p);
+        }
+        p++;
+      }
+    }
+  }
+
+  void uncover_option(int r) {
+    for (int p = r - 1; p != r;) {
+      int j = nodes[p].top;
+      if (j <= 0) {
+        p = nodes[p].down;
+      } else {
+        if (nodes[p].color == 0) {
+          uncover(j);
+        } else if (nodes[p].color > 0) {
+          unpurify(p);
+        }
+        p--;
+      }
+    }
+  }
+
+  int choose() {
+    return policy.choose(*this);
+  }
+
+  bool solve(void) {
+    found = 0;
+    return search();
+  }
+
+  bool search(void) {
+    if (items[0].right == 0) {
+      found++;
+      return report_solution(callback, solution) &&
+          (max_solutions == 0 || found < max_solutions);
+    }
+
+    int mincol = choose();
+    if (nodes[mincol].top == 0)
+      return true;
+
+    bool running = true;
+    cover(mincol);
+    for (int r = nodes[mincol].down; running && r != mincol;
+         r = nodes[r].down) {
+      int before = found;
+      cover_option(r);
+      solution.push_back(option_name(r));
+      running = search();
+      solution.pop_back();
+      uncover_option(r);
+      if (found > before && policy.skip(mincol)) {
+        break;
+      }
+    }
+    uncover(mincol);
+    return running;
+  }
+};
+
+template<class T, class Policy = mrv>
+void colorcover(const sparse_matrix& mat, T callback, int max_solutions = 0,
+                Policy policy = Policy()) {
+  _colorcover<T, Policy> cover(mat, callback, {}, policy);
+  cover.max_solutions = max_solutions;
+  cover.solve();
+}
+
+// Exact cover with multiplicities, as in Knuth's dlx3. Each primary item
+// has a bound, the number of options it may still take, and a slack,
+// how many of those are optional. Branching on an item picks the first
+// option left in its list and tweaks it out, so later siblings only see
+// the options below it. Once the lower bound is met, a last branch
+// takes no more options for the item. Colors work as in _colorcover.
+template<typename T>
+struct _multicover : _colorcover<T> {
+  typedef _colorcover<T> base;
+  using base::primary;
+  using base::callback;
+  using base::max_solutions;
+  using base::found;
+  using base::solution;
+  using base::items;
+  using base::nodes;
+  using base::option_name;
+  using base::hide;
+  using base::unhide;
+  using base::cover;
+  using base::uncover;
+  using base::purify;
+  using base::unpurify;
+  std::vector<int> bound, slack;
+
+  _multicover(const sparse_matrix& mat, T& callback_)
+      : base(mat, callback_), bound(primary + 1, 1), slack(primary + 1, 0) {
+    if (!mat.lo.empty()) {
+      for (int i = 1; i <= primary; i++) {
+        bound[i] = mat.hi[i - 1];
+        slack[i] = mat.hi[i - 1] - mat.lo[i - 1];
+      }
+    }
+  }
+
+  // How many options the item must still take.
+  int needed(int col) const {
+    return std::max(bound[col] - slack[col], 0);
+  }
+
+  // Chooses the item with fewest branches, leftmost on ties.
+  int choose() const {
+    int minvalue = std::numeric_limits<int>::max();
+    int mincol = 0;
+    for (int c = items[0].right; c != 0; c = items[c].right) {
+      int branches = nodes[c].top + 1 - needed(c);
+      if (branches < minvalue) {
+        minvalue = branches;
+        mincol = c;
+      }
+    }
+    return mincol;
+  }
+
+  // Removes the first option x of col's list. If col is covered, x is
+  // already hidden from the other items.
+  void tweak(int col, int x, bool covered) {
+    if (!covered) {
+      hide(x);
+    }
+    int u = nodes[x].up, d = nodes[x].down;
+    nodes[u].down = d;
+    nodes[d].up = u;
+    nodes[col].top--;
+  }
+
+  // Restores the count options tweaked from col, starting at first. The
+  // tweaked nodes still link to each other, so they go back in order.
+  void untweak(int col, int first, int count, bool covered) {
+    for (int x = first; count > 0; count--, x = nodes[x].down) {
+      nodes[nodes[x].up].down = x;
+      nodes[nodes[x].down].up = x;
+      nodes[col].top++;
+      if (!covered) {
+        unhide(x);
+      }
+    }
+  }
+
+  void cover_option(int r) {
+    for (int p = r + 1; p != r;) {
+      int j = nodes[p].top;
+      if (j <= 0) {
+        p = nodes[p].up;
+      } else {
+        if (j <= primary) {
+          if (--bound[j] == 0) {
+            cover(j);
+          }
+        } else if (nodes[p].color == 0) {
+          cover(j);
+        } else if (nodes[p].color > 0) {
+          purify(p);
+        }
+        p++;
+      }
+    }
+  }
+
+  void uncover_option(int r) {
+    for (int p = r - 1; p != r;) {
+      int j = nodes[p].top;
+      if (j <= 0) {
+        p = nodes[p].down;
+      } else {
+        if (j <= primary) {
+          if (bound[j]++ == 0) {
+            uncover(j);
+          }
+        } else if (nodes[p].color == 0) {
+          uncover(j);
+        } else if (nodes[p].color > 0) {
+          unpurify(p);
+        }
+        p--;
+      }
+    }
+  }
+
+  bool solve(void) {
+    found = 0;
+    return search();
+  }
+
+  bool search(void) {
+    if (items[0].right == 0) {
+      found++;
+      return report_solution(callback, solution) &&
+          (max_solutions == 0 || found < max_solutions);
+    }
+
+    int col = choose();
+    int need = needed(col);
+    if (nodes[col].top < need)
+      return true;
+
+    bool covered = --bound[col] == 0;
+    if (covered) {
+      cover(col);
+    }
+    int first = nodes[col].down, tweaks = 0;
+    bool running = true;
+    while (running && nodes[col].down != col && nodes[col].top >= need) {
+      int x = nodes[col].down;
+      tweak(col, x, covered);
+      tweaks++;
+      cover_option(x);
+      solution.push_back(option_name(x));
+      running = search();
+      solution.pop_back();
+      uncover_option(x);
+    }
+    if (running && need == 0) {
+      // Every option of col was tweaked out, leave it with no more.
+      int l = items[col].left, r = items[col].right;
+      if (!covered) {
+        items[l].right = r;
+        items[r].left = l;
+      }
+      running = search();
+      if (!covered) {
+        items[l].right = col;
+        items[r].left = col;
+      }
+    }
+    untweak(col, first, tweaks, covered);
+    if (covered) {
+      uncover(col);
+    }
+    bound[col]++;
+    return running;
+  }
+};
+
+template<class T>
+void multicover(const sparse_matrix& mat, T callback, int max_solutions = 0) {
+  _multicover<T> cover(mat, callback);
+  cover.max_solutions = max_solutions;
+  cover.solve();
+}
+
+// A solution of _costcover and its total cost.
+struct costed_solution {
+  long long cost;
+  std::vector<int> options;
+  bool operator<(const costed_solution& other) const {
+    return cost < other.cost;
+  }
+};
+
+// Minimum-cost exact cover, as in Knuth's dlx5. Options have costs and
+// the search keeps the k cheapest solutions found so far in a heap. Item
+// lists are sorted by cost, so the first option left in a list is the
+// cheapest way to cover its item. Every active item costs at least that,
+// and no option covers more than width items, which bounds the cost of
+// any completion; branches that can't beat the k-th best are cut.
+// Colors work as in _colorcover.
+template<typename T>
+struct _costcover : _colorcover<T> {
+  typedef _colorcover<T> base;
+  using base::w;
+  using base::h;
+  using base::primary;
+  using base::callback;
+  using base::max_solutions;
+  using base::found;
+  using base::solution;
+  using base::items;
+  using base::nodes;
+  using base::option_name;
+  using base::cover;
+  using base::uncover;
+  using base::cover_option;
+  using base::uncover_option;
+  int k, width;
+  long long cost;
+  // Cost of the option each node belongs to, zero on headers.
+  std::vector<long long> node_cost;
+  std::vector<costed_solution> best;
+
+  _costcover(const sparse_matrix& mat, T& callback_, int k_)
+      : base(mat, callback_, by_cost(mat)), k(k_), width(1), cost(0),
+        node_cost(nodes.size(), 0) {
+    for (int p = w + 1; nodes[p].down > 0; p = nodes[p].down + 1) {
+      int c = mat.cost(-nodes[p].top), count = 0;
+      for (int q = p + 1; q <= nodes[p].down; q++) {
+        node_cost[q] = c;
+        count += nodes[q].top <= primary;
+      }
+      width = std::max(width, count);
+    }
+  }
+
+  static std::vector<int> by_cost(const sparse_matrix& mat) {
+    std::vector<int> order(mat.options());
+    for (int i = 0; i < int(order.size()); i++) {
+      order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+      return mat.cost(a) < mat.cost(b);
+    });
+    return order;
+  }
+
+  // Cost a new solution must stay below to enter the top k.
+  long long limit() const {
+    return int(best.size()) < k ? std::numeric_limits<long long>::max()
+                                : best.front().cost;
+  }
+
+  bool record() {
+    found++;
+    if (int(best.size()) == k) {
+      std::pop_heap(best.begin(), best.end());
+      best.pop_back();
+    }
+    best.push_back(costed_solution{cost, solution});
+    std::push_heap(best.begin(), best.end());
+    return report_solution(callback, solution) &&
+        (max_solutions == 0 || found < max_solutions);
+  }
+
+  // Returns the best solutions in increasing order of cost.
+  bool solve(void) {
+    found = 0;
+    cost = 0;
+    best.clear();
+    bool running = k <= 0 || search();
+    std::sort_heap(best.begin(), best.end());
+    return running;
+  }
+
+  bool search(void) {
+    if (items[0].right == 0) {
+      return record();
+    }
+
+    // Chooses the item with fewest options, leftmost on ties, while
+    // adding up the cheapest option of each item.
+    int minvalue = std::numeric_limits<int>::max();
+    int mincol = 0;
+    long long most = 0, total = 0;
+    for (int c = items[0].right; c != 0; c = items[c].right) {
+      if (nodes[c].top < minvalue) {
+        minvalue = nodes[c].top;
+        mincol = c;
+      }
+      long long cheapest = node_cost[nodes[c].down];
+      most = std::max(most, cheapest);
+      total += cheapest;
+    }
+    if (minvalue == 0)
+      return true;
+    long long bound = std::max(most, (total + width - 1) / width);
+    if (cost + bound >= limit())
+      return true;
+
+    bool running = true;
+    cover(mincol);
+    for (int r = nodes[mincol].down; running && r != mincol;
+         r = nodes[r].down) {
+      if (cost + node_cost[r] >= limit()) {
+        break;
+      }
+      cover_option(r);
+      cost += node_cost[r];
+      solution.push_back(option_name(r));
+      running = search();
+      solution.pop_back();
+      cost -= node_cost[r];
+      uncover_option(r);
+    }
+    uncover(mincol);
+    return running;
+  }
+};
+
+// Returns the k cheapest solutions in increasing order of cost. The
+// callback sees each solution as it enters the running top k.
+template<class T>
+std::vector<costed_solution> costcover(
+    const sparse_matrix& mat, int k, T callback) {
+  _costcover<T> cover(mat, callback, k);
+  cover.solve();
+  return cover.best;
+}
+
+inline std::vector<costed_solution> costcover(
+    const sparse_matrix& mat, int k = 1) {
+  return costcover(mat, k, [](const std::vector<int>&) {});
+}
+
+// Nonnegative integer of any size, just enough to count and sample
+// solutions.
+struct big_count {
+  // Base 2^32, least significant first, no leading zeros.
+  std::vector<uint32_t> limbs;
+
+  big_count(uint64_t value = 0) {
+    for (; value > 0; value >>= 32) {
+      limbs.push_back(uint32_t(value));
+    }
+  }
+
+  bool zero() const {
+    return limbs.empty();
+  }
+
+  big_count& operator+=(const big_count& other) {
+    if (limbs.size() < other.limbs.size()) {
+      limbs.resize(other.limbs.size(), 0);
+    }
+    uint64_t carry = 0;
+    for (size_t i = 0; i < limbs.size(); i++) {
+      carry += limbs[i];
+      if (i < other.limbs.size()) {
+        carry += other.limbs[i];
+      }
+      limbs[i] = uint32_t(carry);
+      carry >>= 32;
+    }
+    if (carry > 0) {
+      limbs.push_back(uint32_t(carry));
+    }
+    return *this;
+  }
+
+  bool operator<(const big_count& other) const {
+    if (limbs.size() != other.limbs.size()) {
+      return limbs.size() < other.limbs.size();
+    }
+    for (int i = int(limbs.size()) - 1; i >= 0; i--) {
+      if (limbs[i] != other.limbs[i]) {
+        return limbs[i] < other.limbs[i];
+      }
+    }
+    return false;
+  }
+
+  bool operator==(const big_count& other) const {
+    return limbs == other.limbs;
+  }
+
+  // Uniformly random number below this one, by rejection.
+  template<typename R>
+  big_count random_below(R& rng) const {
+    int top = 32 - __builtin_clz(limbs.back());
+    while (true) {
+      big_count value;
+      value.limbs.resize(limbs.size());
+      for (uint32_t& limb : value.limbs) {
+        limb = uint32_t(rng());
+      }
+      if (top < 32) {
+        value.limbs.back() &= (uint32_t(1) << top) - 1;
+      }
+      while (!value.limbs.empty() && value.limbs.back() == 0) {
+        value.limbs.pop_back();
+      }
+      if (value < *this) {
+        return value;
+      }
+    }
+  }
+
+  std::string str() const {
+    if (zero()) {
+      return "0";
+    }
+    std::vector<uint32_t> digits = limbs;
+    std::string text;
+    while (!digits.empty()) {
+      uint64_t rest = 0;
+      for (int i = int(digits.size()) - 1; i >= 0; i--) {
+        uint64_t current = (rest << 32) | digits[i];
+        digits[i] = uint32_t(current / 1000000000);
+        rest = current % 1000000000;
+      }
+      while (!digits.empty() && digits.back() == 0) {
+        digits.pop_back();
+      }
+      for (int i = 0; i < 9 && (rest > 0 || !digits.empty()); i++) {
+        text.push_back('0' + rest % 10);
+        rest /= 10;
+      }
+    }
+    return std::string(text.rbegin(), text.rend());
+  }
+};
+
+inline std::ostream& operator<<(std::ostream& out, const big_count& value) {
+  return out << value.str();
+}
+
+// All the solutions of an exact cover problem as a ZDD, built as in
+// Knuth's "dancing with ZDDs". Node (option, lo, hi) stands for the
+// solutions with option, taking the rest from hi, plus those from lo.
+// Nodes 0 and 1 are the empty family and the family with just the empty
+// solution. Each node knows how many solutions it holds, which gives
+// exact counts of any size and uniform sampling.
+struct solution_zdd {
+  struct zdd_node {
+    int option, lo, hi;
+  };
+  std::vector<zdd_node> nodes;
+  std::vector<big_count> counts;
+  int root;
+
+  solution_zdd(): nodes(2, zdd_node{-1, 0, 0}), counts(2), root(0) {
+    counts[1] = 1;
+  }
+
+  const big_count& count() const {
+    return counts[root];
+  }
+
+  // A solution taken uniformly at random, empty if there is none.
+  template<typename R>
+  std::vector<int> sample(R& rng) const {
+    std::vector<int> solution;
+    for (int p = root; p > 1;) {
+      const zdd_node& n = nodes[p];
+      if (counts[p].random_below(rng) < counts[n.hi]) {
+        solution.push_back(n.option);
+        p = n.hi;
+      } else {
+        p = n.lo;
+      }
+    }
+    return solution;
+  }
+
+  // Calls callback with every solution, like exactcover.
+  template<typename T>
+  void enumerate(T& callback) const {
+    std::vector<int> solution;
+    enumerate(root, solution, callback);
+  }
+
+  template<typename T>
+  void enumerate(int p, std::vector<int>& solution, T& callback) const {
+    if (p == 1) {
+      callback(solution);
+    } else if (p > 1) {
+      enumerate(nodes[p].lo, solution, callback);
+      solution.push_back(nodes[p].option);
+      enumerate(nodes[p].hi, solution, callback);
+      solution.pop_back();
+    }
+  }
+};
+
+// Builds the solution_zdd by searching with dancing links, and memoizes
+// each subproblem by the set of items already covered, which decides
+// which options are left. Items are chosen by Policy; first_item keeps
+// the sets of covered items few on boards. Colors and multiplicities are
+// not supported.
+template<typename Policy = mrv>
+struct _zddcover {
+  count_solutions unused;
+  _exactcover<count_solutions, Policy> links;
+  solution_zdd zdd;
+  int words;
+  // The items covered so far, and the ZDD of each subproblem seen.
+  std::vector<uint64_t> covered;
+  struct words_hash {
+    size_t operator()(const std::vector<uint64_t>& key) const {
+      uint64_t h = 0;
+      for (uint64_t word : key) {
+        h = (h ^ word) * 0x9e3779b97f4a7c15ull;
+      }
+      return h ^ (h >> 32);
+    }
+  };
+  std::unordered_map<std::vector<uint64_t>, int, words_hash> memo;
+  // Hash consing, so that equal nodes are stored once.
+  struct node_hash {
+    size_t operator()(const std::array<int, 3>& key) const {
+      return (size_t(key[0]) * 0x9e3779b97f4a7c15ull) ^
+          (size_t(key[1]) * 0xc2b2ae3d27d4eb4full) ^ size_t(key[2]);
+    }
+  };
+  std::unordered_map<std::array<int, 3>, int, node_hash> unique;
+
+  _zddcover(const sparse_matrix& mat, Policy policy = Policy())
+      : links(mat, unused, policy), words(mat.w / 64 + 1),
+        covered(words, 0) {
+  }
+
+  int make_node(int option, int lo, int hi) {
+    if (hi == 0) {
+      return lo;
+    }
+    auto found = unique.emplace(std::array<int, 3>{option, lo, hi},
+                                int(zdd.nodes.size()));
+    if (found.second) {
+      zdd.nodes.push_back(solution_zdd::zdd_node{option, lo, hi});
+      zdd.counts.push_back(zdd.counts[lo]);
+      zdd.counts.back() += zdd.counts[hi];
+    }
+    return found.first->second;
+  }
+
+  // Flips the items of the option containing node r in covered.
+  void toggle(int r) {
+    for (int p = r;;) {
+      int j = links.nodes[p].top;
+      if (j <= 0) {
+        p = links.nodes[p].up;
+      } else {
+        covered[(j - 1) / 64] ^= uint64_t(1) << ((j - 1) % 64);
+        p++;
+      }
+      if (p == r) {
+        return;
+      }
+    }
+  }
+
+  int build() {
+    if (links.items[0].right == 0) {
+      return 1;
+    }
+    auto found = memo.find(covered);
+    if (found != memo.end()) {
+      return found->second;
+    }
+    int col = links.choose();
+    std::vector<int> options, children;
+    links.cover(col);
+    for (int r = links.nodes[col].down; r != col; r = links.nodes[r].down) {
+      links.cover_option(r);
+      toggle(r);
+      options.push_back(links.option_name(r));
+      children.push_back(build());
+      toggle(r);
+      links.uncover_option(r);
+    }
+    links.uncover(col);
+    int result = 0;
+    for (int i = int(options.size()) - 1; i >= 0; i--) {
+      result = make_node(options[i], result, children[i]);
+    }
+    memo.emplace(covered, result);
+    return result;
+  }
+
+  solution_zdd& solve() {
+    zdd.root = build();
+    return zdd;
+  }
+};
+
+template<class Policy = mrv>
+solution_zdd build_zdd(const sparse_matrix& mat, Policy policy = Policy()) {
+  _zddcover<Policy> cover(mat, policy);
+  return cover.solve();
+}
+
+// Parallel search. The tree is split at the shallowest depth that gives
+// enough subproblems, and these are dealt to per-thread queues. Each
+// worker runs its own copy of the links, takes subproblems from the back
+// of its queue and steals from the front of the others when it runs dry.
+template<typename T>
+struct _parallel_exactcover {
+  struct work_queue {
+    std::mutex lock;
+    std::deque<std::vector<int>> paths;
+  };
+  // Forwards solutions to the user callback and stops every worker once
+  // one of them is told to stop or the solution limit is reached.
+  struct worker_callback {
+    _parallel_exactcover* pool;
+    T* callback;
+    bool operator()(const std::vector<int>& solution) {
+      if (pool->stopped) {
+        return false;
+      }
+      int count = ++pool->found;
+      if (pool->max_solutions > 0 && count > pool->max_solutions) {
+        pool->stopped = true;
+        return false;
+      }
+      if (!report_solution(*callback, solution) ||
+          count == pool->max_solutions) {
+        pool->stopped = true;
+        return false;
+      }
+      return true;
+    }
+  };
+  std::vector<T>& callbacks;
+  int threads, max_solutions;
+  std::vector<worker_callback> forward;
+  _exactcover<worker_callback> master;
+  std::vector<work_queue> queues;
+  std::atomic<bool> stopped;
+  std::atomic<int> found;
+
+  _parallel_exactcover(const sparse_matrix& mat, std::vector<T>& callbacks_,
+                       int max_solutions_)
+      : callbacks(callbacks_), threads(callbacks_.size()),
+        max_solutions(max_solutions_), forward(make_forward()),
+        master(mat, forward[0]), queues(threads), stopped(false), found(0) {
+  }
+
+  std::vector<worker_callback> make_forward() {
+    std::vector<worker_callback> forward;
+    for (T& callback : callbacks) {
+      forward.push_back(worker_callback{this, &callback});
+    }
+    return forward;
+  }
+
+  void split() {
+    const int target = 16 * threads;
+    std::vector<std::vector<int>> paths;
+    for (int depth = 1;; depth++) {
+      paths.clear();
+      bool deeper = false;
+      std::vector<int> path;
+      auto emit = [&](const std::vector<int>& p) {
+        paths.push_back(p);
+        deeper |= int(p.size()) == depth;
+      };
+      master.split(depth, path, emit);
+      if (int(paths.size()) >= target || !deeper) {
+        break;
+      }
+    }
+    for (int i = 0; i < int(paths.size()); i++) {
+      queues[i % threads].paths.push_back(std::move(paths[i]));
+    }
+  }
+
+  bool next(int id, std::vector<int>& path) {
+    for (int i = 0; i < threads; i++) {
+      work_queue& queue = queues[(id + i) % threads];
+      std::lock_guard<std::mutex> guard(queue.lock);
+      if (!queue.paths.empty()) {
+        if (i == 0) {
+          path = std::move(queue.paths.back());
+          queue.paths.pop_back();
+        } else {
+          path = std::move(queue.paths.front());
+          queue.paths.pop_front();
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void worker(int id) {
+    _exactcover<worker_callback> cover(master, forward[id]);
+    cover.stop = &stopped;
+    std::vector<int> path;
+    while (!stopped && next(id, path)) {
+      cover.apply(path);
+      cover.solve();
+      cover.unapply(path);
+    }
+  }
+
+  void solve() {
+    split();
+    std::vector<std::thread> pool;
+    for (int i = 0; i < threads; i++) {
+      pool.emplace_back(&_parallel_exactcover::worker, this, i);
+    }
+    for (std::thread& t : pool) {
+      t.join();
+    }
+  }
+};
+
+// Each thread reports to its own copy of callback, so per-thread state
+// like count_solutions needs no locking. The copies are returned for the
+// caller to merge.
+template<class T>
+std::vector<T> parallel_exactcover(
+    const sparse_matrix& mat, const T& callback,
+    int threads = std::thread::hardware_concurrency(),
+    int max_solutions = 0) {
+  std::vector<T> callbacks(threads > 0 ? threads : 1, callback);
+  _parallel_exactcover<T> cover(mat, callbacks, max_solutions);
+  cover.solve();
+  return callbacks;
+}
+
+// Wraps a callback so that calls from several threads are serialized.
+template<class T>
+struct serialized_callback {
+  T& callback;
+  std::mutex& lock;
+  serialized_callback(T& callback_, std::mutex& lock_)
+      : callback(callback_), lock(lock_) {}
+  bool operator()(const std::vector<int>& solution) {
+    std::lock_guard<std::mutex> guard(lock);
+    return report_solution(callback, solution);
+  }
+};
+
+// All threads report to the same callback, one solution at a time.
+template<class T>
+void serialized_exactcover(
+    const sparse_matrix& mat, T& callback,
+    int threads = std::thread::hardware_concurrency(),
+    int max_solutions = 0) {
+  std::mutex lock;
+  parallel_exactcover(
+      mat, serialized_callback<T>(callback, lock), threads, max_solutions);
+}
+
+#endif
@@ -96,6 +96,15 @@ class PointConstraint : public TightenConstraint {
     return links;
   }
 
+  // Only looks at the links already fixed, and is done after fixing one.
+  virtual int events() const {
+    return FIXED;
+  }
+
+  virtual bool idempotent() const {
+    return true;
+  }
+
   virtual bool update_constraint(State* state, ConstraintQueue* cqueue) const {
     int fixed = 0;
     int fixedsum = 0;
@@ -115,8 +124,7 @@ class PointConstraint : public TightenConstraint {
       }
       for (int link : links) {
         if (!state->fixed(link)) {
-          state->change_var(link, value, value);
-          cqueue->push_variable(link);
+          cqueue->push_variable(link, state->change_var(link, value, value));
           return true;
         }
       }
@@ -51,7 +51,6 @@ struct print_solutions {
 int main() {
   int stars, x, y;
   cin >> stars >> y >> x;
-  // stars must be 1 in this version.
   vector<string> groups(y);
   for (int i = 0; i < y; i++) {
     cin >> groups[i];
@@ -62,35 +61,31 @@ int main() {
       groups_set.insert(groups[j][i]);
     }
   }
+  // Each 2x2 corner may hold at most one star, so corners are secondary.
   int corners = (x - 1) * (y - 1);
-  int lines = x * y + corners;
-  int columns = y + x + groups_set.size() + corners;
-  vector<vector<bool> > mat(lines, vector<bool>(columns, false));
+  sparse_matrix mat(y + x + groups_set.size(), corners);
+  // Every row, column and group takes exactly the given number of stars.
+  for (int i = 0; i < y + x + int(groups_set.size()); i++) {
+    mat.set_bounds(i, stars, stars);
+  }
   const int slines = 0;
   const int scolumns = y;
   const int sgroups = y + x;
   const int scorners = y + x + groups_set.size();
   for (int j = 0; j < y; j++) {
     for (int i = 0; i < x; i++) {
-      int line = j * x + i;
-      mat[line][slines + i] = true;
-      mat[line][scolumns + j] = true;
-      mat[line][sgroups + (groups[j][i] - 'a')] = true;
-    }
-  }
-  for (int j = 0; j < y - 1; j++) {
-    for (int i = 0; i < x - 1; i++) {
-      int dummyline = x * y + (j * (x - 1) + i);
-      int dummycolumn = scorners + j * (x - 1) + i;
-      mat[dummyline][dummycolumn] = true;
-      for (int jj = 0; jj < 2; jj++) {
-        for (int ii = 0; ii < 2; ii++) {
-          int line = (j+jj) * x + (i + ii);
-          mat[line][scorners + j * (x - 1) + i] = true;
+      vector<int> option = {
+          slines + i, scolumns + j, sgroups + (groups[j][i] - 'a')};
+      for (int jj = j - 1; jj <= j; jj++) {
+        for (int ii = i - 1; ii <= i; ii++) {
+          if (jj >= 0 && jj < y - 1 && ii >= 0 && ii < x - 1) {
+            option.push_back(scorners + jj * (x - 1) + ii);
+          }
         }
       }
+      mat.add_option(option);
     }
   }
   print_solutions print(y, x, groups);
-  exactcover(mat, print);
+  multicover(mat, print);
 }